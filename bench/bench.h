@@ -0,0 +1,101 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "timing.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/core.h>
+
+// Minimal nanobench style harness: every case is run in epochs that are long enough to
+// swamp timer overhead and the median epoch is reported.
+
+struct bench_result {
+    std::string kernel;
+    std::string variant;
+    size_t scene_size = 0;
+    size_t rays = 0;
+    double ns_per_ray = 0;
+    double rays_per_second = 0;
+    double hit_rate = 0;
+    int epochs = 0;
+};
+
+// keeps results alive so the optimizer can't discard the work being measured
+inline volatile uint64_t bench_sink = 0;
+
+class bench_runner {
+public:
+    int epochs = 11;
+    double min_epoch_ms = 10;
+    std::string filter;
+
+    template<typename F>
+    void run(const std::string& kernel, const std::string& variant, size_t scene_size, size_t rays, F&& fn) {
+        auto name = fmt::format("{}/{}/{}", kernel, variant, scene_size);
+        if (!filter.empty() && name.find(filter) == std::string::npos) {
+            return;
+        }
+
+        // warm up and work out how many passes are needed to fill an epoch
+        timer warmup;
+        uint64_t hits = fn();
+        auto pass_ms = std::max(warmup.duration<timer::milliseconds>(), 1e-6);
+        int passes = std::max(1, static_cast<int>(min_epoch_ms / pass_ms));
+
+        std::vector<double> samples;
+        for (int e = 0; e < epochs; e += 1) {
+            timer time;
+            for (int p = 0; p < passes; p += 1) {
+                bench_sink = bench_sink + fn();
+            }
+            samples.push_back(time.duration<timer::nanoseconds>() / (static_cast<double>(passes) * rays));
+        }
+
+        std::sort(samples.begin(), samples.end());
+
+        bench_result result;
+        result.kernel = kernel;
+        result.variant = variant;
+        result.scene_size = scene_size;
+        result.rays = rays;
+        result.ns_per_ray = samples[samples.size() / 2];
+        result.rays_per_second = 1e9 / result.ns_per_ray;
+        result.hit_rate = static_cast<double>(hits) / rays;
+        result.epochs = epochs;
+
+        spdlog::info("{:<40} {:>10.2f} ns/ray {:>10.2f} Mrays/s  hit rate {:.3f}", name, result.ns_per_ray, result.rays_per_second / 1e6, result.hit_rate);
+
+        results.push_back(result);
+    }
+
+    bool write_json(const std::string& filename) const {
+        std::ofstream out(filename);
+        if (!out) {
+            spdlog::error("Failed to open {}", filename);
+            return false;
+        }
+
+        out << "{\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); i += 1) {
+            const auto& r = results[i];
+            out << fmt::format(
+                "    {{ \"name\": \"{}/{}/{}\", \"kernel\": \"{}\", \"variant\": \"{}\", \"scene_size\": {}, \"rays\": {}, "
+                "\"ns_per_ray\": {:.4f}, \"rays_per_second\": {:.1f}, \"hit_rate\": {:.4f}, \"epochs\": {} }}{}\n",
+                r.kernel, r.variant, r.scene_size, r.kernel, r.variant, r.scene_size, r.rays,
+                r.ns_per_ray, r.rays_per_second, r.hit_rate, r.epochs, i + 1 < results.size() ? "," : "");
+        }
+        out << "  ]\n}\n";
+
+        return static_cast<bool>(out);
+    }
+
+private:
+    std::vector<bench_result> results;
+};
+
+#endif//__BENCH_H__
@@ -0,0 +1,309 @@
+#include "bench.h"
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "box.h"
+#include "bvh.h"
+#include "colour.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "quantized_bvh.h"
+#include "sphere.h"
+#include "sphere_set.h"
+
+#include <iostream>
+#include <spdlog/spdlog.h>
+#include <argparse/argparse.hpp>
+
+namespace {
+    const double world_extent = 100.0;
+
+    std::vector<ray> coherent_rays(size_t count) {
+        // a pinhole camera looking at the scene, rays are generated in scanline order
+        auto side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+        point3 origin(0, 0, -2 * world_extent);
+
+        std::vector<ray> rays;
+        rays.reserve(count);
+        for (int j = 0; j < side && rays.size() < count; j += 1) {
+            for (int i = 0; i < side && rays.size() < count; i += 1) {
+                auto u = (i + random_double()) / side - 0.5;
+                auto v = (j + random_double()) / side - 0.5;
+                auto target = point3(u * world_extent, v * world_extent, 0);
+                rays.emplace_back(origin, target - origin, 0.0);
+            }
+        }
+        return rays;
+    }
+
+    std::vector<ray> incoherent_rays(size_t count) {
+        // random origins inside the scene bounds with random directions
+        std::vector<ray> rays;
+        rays.reserve(count);
+        for (size_t i = 0; i < count; i += 1) {
+            auto origin = vec3::random(-world_extent / 2, world_extent / 2);
+            rays.emplace_back(origin, random_unit_vector(), 0.0);
+        }
+        return rays;
+    }
+
+    hittable_list sphere_scene(size_t count, shared_ptr<material> mat) {
+        // keep the density roughly constant so only the object count changes between sizes
+        auto radius = 0.25 * world_extent / std::cbrt(static_cast<double>(count));
+
+        hittable_list world;
+        for (size_t i = 0; i < count; i += 1) {
+            world.add(make_shared<sphere>(point3::random(-world_extent / 2, world_extent / 2), radius, mat));
+        }
+        return world;
+    }
+
+    sphere_set sphere_set_scene(size_t count, shared_ptr<material> mat) {
+        // the same spheres as sphere_scene when generated from the same seed
+        auto radius = 0.25 * world_extent / std::cbrt(static_cast<double>(count));
+
+        sphere_set set;
+        for (size_t i = 0; i < count; i += 1) {
+            set.add(point3::random(-world_extent / 2, world_extent / 2), radius, mat);
+        }
+        set.build();
+        return set;
+    }
+
+    std::vector<size_t> access_order(size_t count, size_t rays, bool shuffled) {
+        // the primitive each ray is tested against, sequential or scattered over the whole set
+        std::vector<size_t> order(rays);
+        for (size_t i = 0; i < rays; i += 1) {
+            order[i] = shuffled ? static_cast<size_t>(random_integer(0, static_cast<int>(count) - 1)) : i % count;
+        }
+        return order;
+    }
+
+    template<typename T>
+    uint64_t trace_all(const T& object, const std::vector<ray>& rays) {
+        uint64_t hits = 0;
+        hit_record rec;
+        for (const auto& r : rays) {
+            hits += object.hit(r, interval(0.001, infinity), rec);
+        }
+        return hits;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("ace-bench", "0.0.1");
+
+    program.add_argument("--json")
+        .help("Write results as JSON to this file")
+        .nargs(1);
+
+    program.add_argument("--filter")
+        .help("Only run benchmarks whose name contains this string")
+        .default_value(std::string(""))
+        .nargs(1);
+
+    program.add_argument("--seed")
+        .help("Seed used to generate scenes and rays")
+        .default_value(uint64_t(1))
+        .nargs(1)
+        .scan<'u', uint64_t>();
+
+    program.add_argument("--max-size")
+        .help("Largest synthetic scene size")
+        .default_value(16384)
+        .nargs(1)
+        .scan<'i', int>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch(const std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    auto seed = program.get<uint64_t>("--seed");
+    auto max_size = static_cast<size_t>(program.get<int>("--max-size"));
+
+    bench_runner runner;
+    runner.filter = program.get("--filter");
+
+    auto mat = make_shared<lambertian>(colour(0.5, 0.5, 0.5));
+    const size_t num_rays = 1 << 16;
+
+    // every case reseeds so results are comparable across runs and commits
+    for (const auto* variant : { "coherent", "incoherent" }) {
+        bool coherent = std::string(variant) == "coherent";
+
+        for (size_t size = 16; size <= max_size; size *= 4) {
+            seed_random(seed);
+            auto rays = coherent ? coherent_rays(num_rays) : incoherent_rays(num_rays);
+            auto order = access_order(size, num_rays, !coherent);
+
+            std::vector<aabb> boxes;
+            std::vector<shared_ptr<sphere>> spheres;
+            std::vector<shared_ptr<quad>> quads;
+            std::vector<shared_ptr<box_primitive>> solid_boxes;
+            std::vector<shared_ptr<hittable_list>> quad_boxes;
+            scene_arena arena;
+            for (size_t i = 0; i < size; i += 1) {
+                auto p = point3::random(-world_extent / 2, world_extent / 2);
+                auto s = vec3::random(1, 10);
+                boxes.emplace_back(p, p + s);
+                spheres.push_back(make_shared<sphere>(p, s.x(), mat));
+                quads.push_back(make_shared<quad>(p, vec3(s.x(), 0, 0), vec3(0, s.y(), s.z()), mat));
+                solid_boxes.push_back(make_shared<box_primitive>(p, p + s, mat));
+                quad_boxes.push_back(box(arena, p, p + s, mat));
+            }
+
+            runner.run("aabb::hit", variant, size, num_rays, [&]() {
+                uint64_t hits = 0;
+                for (size_t i = 0; i < rays.size(); i += 1) {
+                    hits += boxes[order[i]].hit(rays[i], interval(0.001, infinity));
+                }
+                return hits;
+            });
+
+            runner.run("sphere::hit", variant, size, num_rays, [&]() {
+                uint64_t hits = 0;
+                hit_record rec;
+                for (size_t i = 0; i < rays.size(); i += 1) {
+                    hits += spheres[order[i]]->hit(rays[i], interval(0.001, infinity), rec);
+                }
+                return hits;
+            });
+
+            runner.run("quad::hit", variant, size, num_rays, [&]() {
+                uint64_t hits = 0;
+                hit_record rec;
+                for (size_t i = 0; i < rays.size(); i += 1) {
+                    hits += quads[order[i]]->hit(rays[i], interval(0.001, infinity), rec);
+                }
+                return hits;
+            });
+
+            // the same boxes as one slab test and as six quads
+            runner.run("box_primitive::hit", variant, size, num_rays, [&]() {
+                uint64_t hits = 0;
+                hit_record rec;
+                for (size_t i = 0; i < rays.size(); i += 1) {
+                    hits += solid_boxes[order[i]]->hit(rays[i], interval(0.001, infinity), rec);
+                }
+                return hits;
+            });
+
+            runner.run("box::hit", variant, size, num_rays, [&]() {
+                uint64_t hits = 0;
+                hit_record rec;
+                for (size_t i = 0; i < rays.size(); i += 1) {
+                    hits += quad_boxes[order[i]]->hit(rays[i], interval(0.001, infinity), rec);
+                }
+                return hits;
+            });
+        }
+
+        for (size_t size = 16; size <= max_size; size *= 4) {
+            seed_random(seed);
+            auto world = sphere_scene(size, mat);
+            auto rays = coherent ? coherent_rays(num_rays) : incoherent_rays(num_rays);
+
+            timer build_time;
+            bvh_node bvh(world);
+            spdlog::debug("Built bvh over {} spheres in {:.2f}ms", size, build_time.duration<timer::milliseconds>());
+
+            runner.run("bvh_node::hit", variant, size, num_rays, [&]() {
+                return trace_all(bvh, rays);
+            });
+
+            quantized_bvh quantized(world);
+            spdlog::debug("Bvh nodes take {:.1f} bytes per sphere, quantized {:.1f}", static_cast<double>(bvh_node::bytes_used(size)) / size,
+                static_cast<double>(quantized.bytes_used()) / size);
+            runner.run("quantized_bvh::hit", variant, size, num_rays, [&]() {
+                return trace_all(quantized, rays);
+            });
+
+            seed_random(seed);
+            auto set = sphere_set_scene(size, mat);
+            runner.run("sphere_set::hit", variant, size, num_rays, [&]() {
+                return trace_all(set, rays);
+            });
+
+            // linear traversal gets too slow to be interesting past a few thousand objects
+            if (size <= 4096) {
+                auto list_rays = std::vector<ray>(rays.begin(), rays.begin() + num_rays / 16);
+                runner.run("hittable_list::hit", variant, size, list_rays.size(), [&]() {
+                    return trace_all(world, list_rays);
+                });
+            }
+        }
+    }
+
+    // moving a sixteenth of the spheres a little at a time, editing the tree and keeping it in
+    // shape, against building it again, both per sphere
+    for (size_t size = 16; size <= max_size; size *= 4) {
+        seed_random(seed);
+        auto world = sphere_scene(size, mat);
+        auto radius = 0.25 * world_extent / std::cbrt(static_cast<double>(size)); // as sphere_scene
+        auto moved = std::max<size_t>(1, size / 16);
+
+        bvh_node bvh(world);
+        runner.run("bvh_node::replace", "spheres", size, moved, [&]() {
+            for (size_t i = 0; i < moved; i += 1) {
+                auto k = static_cast<size_t>(random_integer(0, static_cast<int>(size) - 1));
+                auto box = world.objects[k]->bounding_box();
+                point3 centre(box.x.min + radius, box.y.min + radius, box.z.min + radius);
+                auto next = make_shared<sphere>(centre + vec3::random(-radius, radius), radius, mat);
+                bvh.replace(world.objects[k].get(), next);
+                world.objects[k] = next;
+            }
+            return bvh.optimize();
+        });
+        spdlog::debug("Bvh cost per ray {:.1f} after edits, {:.1f} when built", bvh.cost_ratio(), bvh.built_cost_ratio());
+
+        runner.run("bvh_node::bvh_node", "spheres", size, size, [&]() {
+            bvh_node rebuilt(world);
+            return static_cast<uint64_t>(rebuilt.cost_ratio() > 0);
+        });
+    }
+
+    // resolving accumulated samples to display pixels, one at a time and in batches
+    {
+        seed_random(seed);
+        const size_t num_pixels = 1920 * 1080;
+        std::vector<float> sums(num_pixels * 3);
+        std::vector<uint32_t> counts(num_pixels);
+        for (size_t i = 0; i < num_pixels; i += 1) {
+            counts[i] = random_integer(0, 64);
+            for (int c = 0; c < 3; c += 1) {
+                sums[i * 3 + c] = static_cast<float>(random_double(0, 1.2) * counts[i]);
+            }
+        }
+        std::vector<pixel> pixels(num_pixels);
+
+        runner.run("write_colour", "image", num_pixels, num_pixels, [&]() {
+            uint64_t written = 0;
+            for (size_t i = 0; i < num_pixels; i += 1) {
+                if (counts[i] > 0) {
+                    write_colour(pixels[i], colour(sums[i * 3], sums[i * 3 + 1], sums[i * 3 + 2]), counts[i]);
+                    written += 1;
+                }
+            }
+            return written;
+        });
+
+        runner.run("write_colours", "image", num_pixels, num_pixels, [&]() {
+            write_colours(pixels.data(), sums.data(), counts.data(), num_pixels);
+            return static_cast<uint64_t>(num_pixels);
+        });
+    }
+
+    if (auto json_file = program.present("--json")) {
+        if (!runner.write_json(*json_file)) {
+            return 1;
+        }
+        spdlog::info("Wrote results to {}", *json_file);
+    }
+
+    return 0;
+}
@@ -4,14 +4,18 @@
 #include "interval.h"
 #include "vec3.h"
 #include "ray.h"
+#include "stats.h"
 
+// Bounds are stored in real, rounded outwards from the double values they are built from.
 class aabb {
 public:
-    interval x, y, z;
+    using bounds = basic_interval<real>;
+
+    bounds x, y, z;
 
     aabb() {} // default is empty because intervals are empty
 
-    aabb(const interval& ix, const interval& iy, const interval& iz)
+    aabb(const bounds& ix, const bounds& iy, const bounds& iz)
         : x(ix), y(iy), z(iz) {}
 
     aabb(const point3& a, const point3& b) {
@@ -30,14 +34,14 @@ public:
     aabb pad() {
         // return an aabb that has sides no narrower tahn some delta, padding if necessary
         double delta = 0.0001;
-        interval new_x = (x.size() >= delta) ? x : x.expand(delta);
-        interval new_y = (y.size() >= delta) ? y : y.expand(delta);
-        interval new_z = (z.size() >= delta) ? z : z.expand(delta);
+        bounds new_x = (x.size() >= delta) ? x : x.expand(delta);
+        bounds new_y = (y.size() >= delta) ? y : y.expand(delta);
+        bounds new_z = (z.size() >= delta) ? z : z.expand(delta);
 
         return aabb(new_x, new_y, new_z);
     }
 
-    const interval& axis(int n) const {
+    const bounds& axis(int n) const {
         if (n == 1) {
             return y;
         }
@@ -65,28 +69,39 @@ public:
     //     return true;
     // }
 
-    // optimized version by Andrew Kensler from Pixar
+    // optimized version by Andrew Kensler from Pixar, run in real. It is conservative: the box
+    // grows by however far the ray origin moved when it was rounded to real, and the exit
+    // distance is widened by the rounding error of the arithmetic, so a ray that touches the
+    // box is never culled
     bool hit(const ray& r, interval ray_t) const {
-        for (int a = 0; a < 3; a += 1) {
-            auto invD = 1 / r.direction()[a];
-            auto orig = r.origin()[a];
+        STAT_INC(aabb_tests);
+
+        const auto& orig = r.traversal_origin();
+        const auto& inv_d = r.inv_direction();
+        auto pad = r.origin_error();
+
+        auto t_min = round_down<real>(ray_t.min);
+        auto t_max = round_up<real>(ray_t.max);
 
-            auto t0 = (axis(a).min - orig) * invD;
-            auto t1 = (axis(a).max - orig) * invD;
+        for (int a = 0; a < 3; a += 1) {
+            auto t0 = (axis(a).min - pad - orig[a]) * inv_d[a];
+            auto t1 = (axis(a).max + pad - orig[a]) * inv_d[a];
 
-            if (invD < 0) {
+            if (inv_d[a] < 0) {
                 std::swap(t0, t1);
             }
 
-            if (t0 > ray_t.min) {
-                ray_t.min = t0;
+            t1 *= 1 + 2 * rounding_error<real>(3);
+
+            if (t0 > t_min) {
+                t_min = t0;
             }
 
-            if (t1 < ray_t.max) {
-                ray_t.max = t1;
+            if (t1 < t_max) {
+                t_max = t1;
             }
 
-            if (ray_t.max <= ray_t.min) {
+            if (t_max <= t_min) {
                 return false;
             }
         }
@@ -109,6 +124,10 @@ public:
         };
     }
 
+    bool empty() const {
+        return x.min > x.max || y.min > y.max || z.min > z.max;
+    }
+
     inline vec3 size() const {
         return {
             x.size(),
@@ -116,8 +135,34 @@ public:
             z.size(),
         };
     }
+
+    bool contains(const aabb& box) const {
+        return x.min <= box.x.min && box.x.max <= x.max
+            && y.min <= box.y.min && box.y.max <= y.max
+            && z.min <= box.z.min && box.z.max <= z.max;
+    }
+
+    // surface area, infinite if any side is
+    double area() const {
+        if (empty()) {
+            return 0;
+        }
+        if (!std::isfinite(static_cast<double>(x.size() + y.size() + z.size()))) {
+            return infinity;
+        }
+        auto s = size();
+        return 2 * (s.x() * s.y() + s.y() * s.z() + s.z() * s.x());
+    }
 };
 
+// the part of both boxes, empty if they don't overlap
+inline aabb overlap(const aabb& a, const aabb& b) {
+    return aabb(
+        aabb::bounds(fmax(a.x.min, b.x.min), fmin(a.x.max, b.x.max)),
+        aabb::bounds(fmax(a.y.min, b.y.min), fmin(a.y.max, b.y.max)),
+        aabb::bounds(fmax(a.z.min, b.z.min), fmin(a.z.max, b.z.max)));
+}
+
 inline aabb operator+(const aabb& bbox, const vec3& offset) {
     return aabb(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
 }
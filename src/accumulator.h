@@ -0,0 +1,151 @@
+#ifndef __ACCUMULATOR_H__
+#define __ACCUMULATOR_H__
+
+#include "colour.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct accumulator_snapshot {
+    int width = 0;
+    int height = 0;
+    std::vector<float> sums; // rgb triples, row major
+    std::vector<uint32_t> counts;
+
+    uint64_t total_samples() const {
+        uint64_t total = 0;
+        for (auto count : counts) {
+            total += count;
+        }
+        return total;
+    }
+};
+
+class accumulator {
+public:
+    accumulator() {}
+
+    accumulator(int w, int h) {
+        resize(w, h);
+    }
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    void resize(int _w, int _h) {
+        w = _w;
+        h = _h;
+        auto n = static_cast<size_t>(w) * h;
+        sums.reset(new std::atomic<float>[n * 3]());
+        counts.reset(new std::atomic<uint32_t>[n]());
+        versions.reset(new std::atomic<uint32_t>[n]());
+    }
+
+    void clear() {
+        auto n = static_cast<size_t>(w) * h;
+        for (size_t i = 0; i < n; i += 1) {
+            for (int c = 0; c < 3; c += 1) {
+                sums[i * 3 + c].store(0.0f, std::memory_order_relaxed);
+            }
+            counts[i].store(0, std::memory_order_relaxed);
+            versions[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(int x, int y, const colour& sum, int samples) {
+        // Each pixel is owned by a single task at a time, so there is only ever one writer, but
+        // the checkpoint writer and the preview read pixels while they are rendered. A pixel's
+        // version is odd while it is being written, so a reader that saw it odd, or saw it
+        // change, knows the sums and count it read may not belong together and reads again
+        auto i = index(x, y);
+        auto version = versions[i].load(std::memory_order_relaxed);
+        versions[i].store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        sums[i * 3 + 0].store(sums[i * 3 + 0].load(std::memory_order_relaxed) + static_cast<float>(sum.x()), std::memory_order_relaxed);
+        sums[i * 3 + 1].store(sums[i * 3 + 1].load(std::memory_order_relaxed) + static_cast<float>(sum.y()), std::memory_order_relaxed);
+        sums[i * 3 + 2].store(sums[i * 3 + 2].load(std::memory_order_relaxed) + static_cast<float>(sum.z()), std::memory_order_relaxed);
+        counts[i].store(counts[i].load(std::memory_order_relaxed) + samples, std::memory_order_relaxed);
+
+        versions[i].store(version + 2, std::memory_order_release);
+    }
+
+    colour sum_at(int x, int y) const {
+        float s[3];
+        read(index(x, y), s);
+        return colour(s[0], s[1], s[2]);
+    }
+
+    int count_at(int x, int y) const {
+        return static_cast<int>(counts[index(x, y)].load(std::memory_order_acquire));
+    }
+
+    void read_row(int x1, int x2, int y, float* sums_out, uint32_t* counts_out) const {
+        // copies pixels x1 to x2 of a row for write_colours, with the same care as snapshot
+        auto first = index(x1, y);
+        for (int i = 0; i < x2 - x1; i += 1) {
+            counts_out[i] = read(first + i, sums_out + i * 3);
+        }
+    }
+
+    accumulator_snapshot snapshot() const {
+        accumulator_snapshot snap;
+        snap.width = w;
+        snap.height = h;
+        snap.counts.resize(static_cast<size_t>(w) * h);
+        snap.sums.resize(snap.counts.size() * 3);
+
+        for (size_t i = 0; i < snap.counts.size(); i += 1) {
+            snap.counts[i] = read(i, &snap.sums[i * 3]);
+        }
+
+        return snap;
+    }
+
+    void restore(const accumulator_snapshot& snap) {
+        resize(snap.width, snap.height);
+        for (size_t i = 0; i < snap.counts.size(); i += 1) {
+            for (int c = 0; c < 3; c += 1) {
+                sums[i * 3 + c].store(snap.sums[i * 3 + c], std::memory_order_relaxed);
+            }
+            counts[i].store(snap.counts[i], std::memory_order_relaxed);
+        }
+    }
+
+private:
+    int w = 0;
+    int h = 0;
+    std::unique_ptr<std::atomic<float>[]> sums; // rgb triples, row major
+    std::unique_ptr<std::atomic<uint32_t>[]> counts;
+    std::unique_ptr<std::atomic<uint32_t>[]> versions; // odd while the pixel is being added to
+
+    inline size_t index(int x, int y) const {
+        return static_cast<size_t>(y) * w + x;
+    }
+
+    // the sums and count of a pixel as they were between two adds, retrying while one is
+    // under way. a pixel only takes a few stores to add to, so this rarely goes round twice
+    uint32_t read(size_t i, float* sums_out) const {
+        while (true) {
+            auto before = versions[i].load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+
+            for (int c = 0; c < 3; c += 1) {
+                sums_out[c] = sums[i * 3 + c].load(std::memory_order_relaxed);
+            }
+            auto count = counts[i].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (versions[i].load(std::memory_order_relaxed) == before) {
+                return count;
+            }
+        }
+    }
+};
+
+#endif//__ACCUMULATOR_H__
@@ -0,0 +1,248 @@
+#ifndef __ANIMATION_H__
+#define __ANIMATION_H__
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <vector>
+
+// Animation time runs from 0 at the first frame towards 1 at the last. Keyframes are
+// interpolated linearly and hold their value before the first and after the last key.
+
+// placement of an object at a point in time: a rotation about the y axis, then a translation
+struct transform_keyframe {
+    double time;
+    vec3 offset;
+    double angle; // degrees
+};
+
+struct camera_keyframe {
+    double time;
+    point3 lookfrom;
+    point3 lookat;
+};
+
+// finds the keys either side of time, keys must be sorted by time
+template<typename K>
+inline double find_keyframes(const std::vector<K>& keys, double time, const K*& a, const K*& b) {
+    auto next = std::upper_bound(keys.begin(), keys.end(), time, [](double t, const K& key) {
+        return t < key.time;
+    });
+
+    if (next == keys.begin()) {
+        a = b = &keys.front();
+        return 0;
+    }
+    if (next == keys.end()) {
+        a = b = &keys.back();
+        return 0;
+    }
+
+    a = &*(next - 1);
+    b = &*next;
+    return (time - a->time) / (b->time - a->time);
+}
+
+// Rotates and translates an object along a keyframed path, the same as rotate_y wrapped in
+// translate but with a transform that can change between frames.
+class animated_instance : public hittable {
+public:
+    animated_instance(shared_ptr<hittable> p, std::vector<transform_keyframe> keyframes)
+        : object(p), keys(std::move(keyframes))
+    {
+        std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) {
+            return a.time < b.time;
+        });
+        current = evaluate(0);
+        next = current;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        STAT_INC(instance_tests);
+
+        const auto& s = current;
+
+        // convert from world to object space
+        auto offset_origin = r.origin() - s.offset;
+        auto origin = offset_origin;
+        auto direction = r.direction();
+
+        origin[0] = s.cos_theta * offset_origin[0] - s.sin_theta * offset_origin[2];
+        origin[2] = s.sin_theta * offset_origin[0] + s.cos_theta * offset_origin[2];
+
+        direction[0] = s.cos_theta * r.direction()[0] - s.sin_theta * r.direction()[2];
+        direction[2] = s.sin_theta * r.direction()[0] + s.cos_theta * r.direction()[2];
+
+        ray object_r(origin, direction, r.time());
+
+        if (!object->hit(object_r, ray_t, rec)) {
+            return false;
+        }
+
+        // convert from object to world space
+        auto p = rec.p;
+        p[0] = s.cos_theta * rec.p[0] + s.sin_theta * rec.p[2];
+        p[2] = -s.sin_theta * rec.p[0] + s.cos_theta * rec.p[2];
+
+        auto normal = rec.normal;
+        normal[0] = s.cos_theta * rec.normal[0] + s.sin_theta * rec.normal[2];
+        normal[2] = -s.sin_theta * rec.normal[0] + s.cos_theta * rec.normal[2];
+
+        rec.p = p + s.offset;
+        rec.normal = normal;
+        rec.p_error = rec.p_error * (fabs(s.cos_theta) + fabs(s.sin_theta)) + rounding_error(4) * max_abs_component(rec.p);
+
+        return true;
+    }
+
+    aabb bounding_box() const override {
+        return current.bbox;
+    }
+
+    void draw(const draw_options& options) const override;
+
+    bool animated() const override {
+        return true;
+    }
+
+    aabb prepare_frame(double time) override {
+        next = evaluate(time);
+        return next.bbox;
+    }
+
+    void commit_frame() override {
+        current = next;
+    }
+
+private:
+    struct placement {
+        vec3 offset;
+        double angle = 0;
+        double sin_theta = 0;
+        double cos_theta = 1;
+        aabb bbox;
+    };
+
+    shared_ptr<hittable> object;
+    std::vector<transform_keyframe> keys;
+    placement current; // read while tracing
+    placement next; // written by prepare_frame
+
+    placement evaluate(double time) const {
+        placement s;
+        if (!keys.empty()) {
+            const transform_keyframe* a;
+            const transform_keyframe* b;
+            auto t = find_keyframes(keys, time, a, b);
+            s.offset = (1 - t) * a->offset + t * b->offset;
+            s.angle = (1 - t) * a->angle + t * b->angle;
+        }
+
+        auto radians = degrees_to_radians(s.angle);
+        s.sin_theta = sin(radians);
+        s.cos_theta = cos(radians);
+
+        // bounds of the rotated corners of the object's box
+        auto box = object->bounding_box();
+        point3 min(infinity, infinity, infinity);
+        point3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i += 1) {
+            for (int j = 0; j < 2; j += 1) {
+                for (int k = 0; k < 2; k += 1) {
+                    auto x = i * box.x.max + (1 - i) * box.x.min;
+                    auto y = j * box.y.max + (1 - j) * box.y.min;
+                    auto z = k * box.z.max + (1 - k) * box.z.min;
+
+                    vec3 tester(s.cos_theta * x + s.sin_theta * z, y, -s.sin_theta * x + s.cos_theta * z);
+                    for (int c = 0; c < 3; c += 1) {
+                        min[c] = fmin(min[c], tester[c]);
+                        max[c] = fmax(max[c], tester[c]);
+                    }
+                }
+            }
+        }
+
+        s.bbox = aabb(min, max) + s.offset;
+        return s;
+    }
+};
+
+// keyframed lookfrom and lookat, empty paths leave the camera where the scene put it
+class camera_path {
+public:
+    std::vector<camera_keyframe> keys;
+
+    bool empty() const {
+        return keys.empty();
+    }
+
+    void add(double time, const point3& lookfrom, const point3& lookat) {
+        keys.push_back(camera_keyframe{ time, lookfrom, lookat });
+        std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) {
+            return a.time < b.time;
+        });
+    }
+
+    camera_keyframe at(double time) const {
+        const camera_keyframe* a;
+        const camera_keyframe* b;
+        auto t = find_keyframes(keys, time, a, b);
+        return camera_keyframe{ time, (1 - t) * a->lookfrom + t * b->lookfrom, (1 - t) * a->lookat + t * b->lookat };
+    }
+
+    // one full orbit around lookat, keyed finely enough that the chords between keys stay
+    // within a small fraction of the radius
+    static camera_path turntable(const point3& lookfrom, const point3& lookat, int steps = 360) {
+        camera_path path;
+        auto arm = lookfrom - lookat;
+        for (int i = 0; i <= steps; i += 1) {
+            auto time = static_cast<double>(i) / steps;
+            auto radians = 2 * pi * time;
+            auto x = cos(radians) * arm.x() + sin(radians) * arm.z();
+            auto z = -sin(radians) * arm.x() + cos(radians) * arm.z();
+            path.keys.push_back(camera_keyframe{ time, lookat + vec3(x, arm.y(), z), lookat });
+        }
+        return path;
+    }
+};
+
+// Double buffers the scene between frames. prepare() works out the next frame, refitting the
+// bvh as it goes, and is safe to run while the current frame is still being traced since it
+// only writes state that tracing never reads. commit() then switches over in one short step.
+class animation {
+public:
+    camera_path path;
+
+    void prepare(hittable& world, double time) {
+        trace_zone zone("scene update", "scene");
+        if (!path.empty()) {
+            next_view = path.at(time);
+        }
+        world.prepare_frame(time);
+    }
+
+    // only call while nothing is tracing the world or rendering with the camera
+    void commit(hittable& world, camera& cam) {
+        trace_zone zone("scene commit", "scene");
+        world.commit_frame();
+        if (!path.empty()) {
+            cam.lookfrom = next_view.lookfrom;
+            cam.lookat = next_view.lookat;
+            cam.init();
+        }
+    }
+
+    // frame time for looping sequences, the last frame stops one step short of the first
+    static double frame_time(int frame, int frames) {
+        return frames > 1 ? static_cast<double>(frame) / frames : 0.0;
+    }
+
+private:
+    camera_keyframe next_view{};
+};
+
+#endif//__ANIMATION_H__
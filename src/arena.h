@@ -0,0 +1,136 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/color.h>
+
+// Owns every object of a scene. Objects of the same type are packed next to each other in
+// large blocks rather than each being its own heap allocation with a control block, and the
+// whole lot is destroyed and freed in one go with the arena.
+//
+// The shared_ptrs handed out alias an empty owner, so they don't own anything and copying one
+// never touches a reference count. The arena must outlive everything that points into it.
+class scene_arena {
+public:
+    scene_arena() = default;
+
+    ~scene_arena() {
+        // newest pools first, objects don't own each other so the order is only for tidiness
+        while (!pools.empty()) {
+            pools.pop_back();
+        }
+    }
+
+    scene_arena(const scene_arena&) = delete;
+    scene_arena& operator=(const scene_arena&) = delete;
+
+    template<typename T, typename... Args>
+    std::shared_ptr<T> make(Args&&... args) {
+        auto* object = pool_for<T>().create(std::forward<Args>(args)...);
+        return std::shared_ptr<T>(std::shared_ptr<void>(), object);
+    }
+
+    size_t object_count() const {
+        size_t count = 0;
+        for (const auto& p : pools) {
+            count += p->count;
+        }
+        return count;
+    }
+
+    size_t bytes_reserved() const {
+        size_t bytes = 0;
+        for (const auto& p : pools) {
+            bytes += p->bytes_reserved();
+        }
+        return bytes;
+    }
+
+    void log_usage() const {
+        using namespace fmt;
+        spdlog::debug("Scene arena: {} objects of {} types in {}", object_count(), pools.size(),
+            format(fg(color::aqua), "{:.1f} KiB", bytes_reserved() / 1024.0));
+    }
+
+private:
+    struct pool_base {
+        size_t count = 0;
+
+        virtual ~pool_base() = default;
+        virtual size_t bytes_reserved() const = 0;
+    };
+
+    template<typename T>
+    struct pool : public pool_base {
+        // about 64KiB per block, so small objects share cache lines and pages with their neighbours
+        static constexpr size_t per_block = sizeof(T) >= 65536 ? 1 : 65536 / sizeof(T);
+
+        std::vector<T*> blocks;
+        size_t used = per_block; // slots taken in the last block
+        std::vector<T*> holes; // slots whose constructor threw
+
+        ~pool() override {
+            for (size_t b = blocks.size(); b > 0; b -= 1) {
+                auto* block = blocks[b - 1];
+                auto n = b == blocks.size() ? used : per_block;
+                for (size_t i = n; i > 0; i -= 1) {
+                    if (holes.empty() || std::find(holes.begin(), holes.end(), block + i - 1) == holes.end()) {
+                        block[i - 1].~T();
+                    }
+                }
+                ::operator delete(block, std::align_val_t(alignof(T)));
+            }
+        }
+
+        template<typename... Args>
+        T* create(Args&&... args) {
+            // the slot is taken before constructing, since constructors like bvh_node's make
+            // more objects of their own type from the same pool
+            if (used == per_block) {
+                blocks.push_back(static_cast<T*>(::operator new(per_block * sizeof(T), std::align_val_t(alignof(T)))));
+                used = 0;
+            }
+            auto* slot = blocks.back() + used;
+            used += 1;
+
+            try {
+                auto* object = new (slot) T(std::forward<Args>(args)...);
+                count += 1;
+                return object;
+            } catch (...) {
+                holes.push_back(slot);
+                throw;
+            }
+        }
+
+        size_t bytes_reserved() const override {
+            return blocks.size() * per_block * sizeof(T);
+        }
+    };
+
+    std::vector<std::unique_ptr<pool_base>> pools; // in creation order
+    std::unordered_map<std::type_index, pool_base*> pools_by_type;
+
+    template<typename T>
+    pool<T>& pool_for() {
+        auto it = pools_by_type.find(typeid(T));
+        if (it != pools_by_type.end()) {
+            return *static_cast<pool<T>*>(it->second);
+        }
+
+        pools.push_back(std::make_unique<pool<T>>());
+        auto* p = static_cast<pool<T>*>(pools.back().get());
+        pools_by_type.emplace(typeid(T), p);
+        return *p;
+    }
+};
+
+#endif//__ARENA_H__
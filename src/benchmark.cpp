@@ -0,0 +1,177 @@
+#include "benchmark.h"
+#include "rtweekend.h"
+
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/color.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+long peak_rss_kb() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+    }
+    return 0;
+#else
+#if defined(__linux__)
+    // ru_maxrss ignores reset_peak_rss, VmHWM doesn't
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::stol(line.substr(6));
+        }
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return static_cast<long>(usage.ru_maxrss / 1024); // bytes on macOS
+#else
+    return static_cast<long>(usage.ru_maxrss); // kilobytes on linux
+#endif
+#endif
+}
+
+bool reset_peak_rss() {
+#if defined(__linux__)
+    // writing 5 to clear_refs resets the high water mark, linux 4.0 and later
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.flush();
+    return static_cast<bool>(clear_refs);
+#else
+    return false;
+#endif
+}
+
+namespace {
+    std::string json_number(double value) {
+        // json has no infinity, a tree over an unbounded object costs that much
+        return std::isfinite(value) ? fmt::format("{:.4f}", value) : "null";
+    }
+}
+
+bool write_benchmark_results(const std::string& filename, const benchmark_settings& settings, const std::vector<benchmark_result>& results) {
+    std::ostringstream out;
+
+    out << "{\n";
+    out << fmt::format("  \"settings\": {{ \"image_width\": {}, \"aspect_ratio\": {:.6f}, \"samples_per_pixel\": {}, \"max_depth\": {}, \"seed\": {}, \"threads\": {}, \"packet_size\": {}, \"single_precision\": {}, \"wavefront\": {}, \"sort_rays\": {}, \"quantized_bvh\": {}, \"split_budget\": {:.2f}, \"peak_rss_per_scene\": {} }},\n",
+        settings.image_width, settings.aspect_ratio, settings.samples_per_pixel, settings.max_depth, settings.seed, settings.threads, settings.packet_size, ACE_SINGLE_PRECISION, settings.wavefront ? 1 : 0, settings.sort_rays ? 1 : 0, settings.quantized_bvh ? 1 : 0, settings.split_budget, settings.peak_rss_per_scene ? 1 : 0);
+    out << "  \"scenes\": [\n";
+
+    // one scene per line keeps the file easy to diff and to read back
+    for (size_t i = 0; i < results.size(); i += 1) {
+        const auto& r = results[i];
+        out << fmt::format("    {{ \"scene\": {}, \"wall_ms\": {:.3f}, \"scene_build_ms\": {:.3f}, \"bvh_build_ms\": {:.3f}, \"bvh_bytes_per_object\": {:.1f}, \"render_ms\": {:.3f}, \"rays\": {}, \"mrays_per_second\": {:.4f}, \"peak_rss_kb\": {}, \"huge_objects\": {}, \"bvh_tests\": {}, \"bvh_tests_with_huge\": {} }}{}\n",
+            r.scene, r.wall_ms, r.scene_build_ms, r.bvh_build_ms, r.bvh_bytes_per_object, r.render_ms, r.rays, r.mrays_per_second, r.peak_rss_kb,
+            r.huge_objects, json_number(r.bvh_tests), json_number(r.bvh_tests_with_huge), i + 1 < results.size() ? "," : "");
+    }
+
+    out << "  ]\n}\n";
+
+    if (filename.empty() || filename == "-") {
+        std::cout << out.str();
+        return true;
+    }
+
+    std::ofstream file(filename);
+    if (!file) {
+        spdlog::error("Failed to open benchmark results file: {}", filename);
+        return false;
+    }
+    file << out.str();
+    return static_cast<bool>(file);
+}
+
+bool read_benchmark_results(const std::string& filename, std::vector<benchmark_result>& results) {
+    std::ifstream file(filename);
+    if (!file) {
+        spdlog::error("Failed to open benchmark results file: {}", filename);
+        return false;
+    }
+
+    auto field = [](const std::string& line, const char* name, double& value) {
+        std::smatch match;
+        std::regex pattern(fmt::format("\"{}\":\\s*([-0-9.eE+]+)", name));
+        if (!std::regex_search(line, match, pattern)) {
+            return false;
+        }
+        value = std::stod(match[1].str());
+        return true;
+    };
+
+    std::string line;
+    while (std::getline(file, line)) {
+        double scene;
+        if (!field(line, "scene", scene)) {
+            continue;
+        }
+
+        benchmark_result r;
+        double rays = 0;
+        double rss = 0;
+        r.scene = static_cast<int>(scene);
+        field(line, "wall_ms", r.wall_ms);
+        field(line, "scene_build_ms", r.scene_build_ms);
+        field(line, "bvh_build_ms", r.bvh_build_ms);
+        field(line, "bvh_bytes_per_object", r.bvh_bytes_per_object);
+        field(line, "render_ms", r.render_ms);
+        field(line, "rays", rays);
+        field(line, "mrays_per_second", r.mrays_per_second);
+        field(line, "peak_rss_kb", rss);
+        double huge = 0;
+        field(line, "huge_objects", huge);
+        field(line, "bvh_tests", r.bvh_tests);
+        field(line, "bvh_tests_with_huge", r.bvh_tests_with_huge);
+        r.huge_objects = static_cast<size_t>(huge);
+        r.rays = static_cast<uint64_t>(rays);
+        r.peak_rss_kb = static_cast<long>(rss);
+        results.push_back(r);
+    }
+
+    if (results.empty()) {
+        spdlog::error("No benchmark results found in: {}", filename);
+        return false;
+    }
+
+    return true;
+}
+
+bool compare_benchmark_results(const std::vector<benchmark_result>& baseline, const std::vector<benchmark_result>& current, double threshold_percent) {
+    using namespace fmt;
+
+    bool passed = true;
+
+    for (const auto& curr : current) {
+        for (const auto& base : baseline) {
+            if (base.scene != curr.scene || base.mrays_per_second <= 0) {
+                continue;
+            }
+
+            auto change = 100.0 * (curr.mrays_per_second - base.mrays_per_second) / base.mrays_per_second;
+            bool regressed = change < -threshold_percent;
+            auto colour = regressed ? color::red : change > threshold_percent ? color::green : color::aqua;
+
+            spdlog::info("  scene {}: {:.2f} -> {:.2f} Mrays/s ({})", curr.scene, base.mrays_per_second, curr.mrays_per_second, format(fg(colour), "{:+.1f}%", change));
+
+            if (regressed) {
+                passed = false;
+            }
+        }
+    }
+
+    return passed;
+}
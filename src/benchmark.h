@@ -0,0 +1,56 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct benchmark_settings {
+    int image_width = 384;
+    double aspect_ratio = 16.0 / 9.0;
+    int samples_per_pixel = 16;
+    int max_depth = 8;
+    uint64_t seed = 1;
+    int threads = 1;
+    int packet_size = 8;
+    bool wavefront = false;
+    bool sort_rays = false;
+    bool quantized_bvh = false;
+    double split_budget = 0;
+    bool peak_rss_per_scene = false; // set by the run, see reset_peak_rss
+};
+
+struct benchmark_result {
+    int scene = 0;
+    double scene_build_ms = 0;
+    double bvh_build_ms = 0;
+    double bvh_bytes_per_object = 0;
+    double render_ms = 0;
+    double wall_ms = 0;
+    uint64_t rays = 0;
+    double mrays_per_second = 0;
+    long peak_rss_kb = 0;
+
+    // expected tests per ray with the huge objects beside the bvh and in it, see
+    // measure_huge_objects, only set when the scene has some
+    size_t huge_objects = 0;
+    double bvh_tests = 0;
+    double bvh_tests_with_huge = 0;
+};
+
+// high water mark of the resident set size of this process since the last reset_peak_rss, or
+// since it started where the high water mark can't be reset
+long peak_rss_kb();
+
+// starts the high water mark again from the current resident set, so each benchmark scene gets
+// its own peak. returns false where that isn't supported, only linux has it
+bool reset_peak_rss();
+
+bool write_benchmark_results(const std::string& filename, const benchmark_settings& settings, const std::vector<benchmark_result>& results);
+bool read_benchmark_results(const std::string& filename, std::vector<benchmark_result>& results);
+
+// logs a comparison of every scene present in both runs, returns false if any scene lost more
+// than threshold_percent of its throughput
+bool compare_benchmark_results(const std::vector<benchmark_result>& baseline, const std::vector<benchmark_result>& current, double threshold_percent);
+
+#endif//__BENCHMARK_H__
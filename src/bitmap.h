@@ -2,11 +2,10 @@
 #define __BITMAP_H__
 
 #include "pixel.h"
-#include "timing.h"
+#include "image_writer.h"
 
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bundled/color.h>
-#include <stb_image_write.h>
 
 class bitmap {
 public:
@@ -27,21 +26,20 @@ public:
         return data[(y * width) + x];
     }
 
-    void write_to_file(std::string filename) {
+    image_buffer to_image() const {
+        image_buffer image;
+        image.width = width;
+        image.height = height;
+        image.pixels.assign(data, data + static_cast<size_t>(width) * height);
+        return image;
+    }
+
+    bool write_to_file(std::string filename) const {
+        // the format comes from the extension, see image_writer.h
         using namespace fmt;
 
         spdlog::info("Writing bitmap to file: {}", styled(filename, fg(color(color::aqua))));
-
-        const int channels = 4;
-        timer time;
-
-        auto img = stbi_write_png(filename.c_str(), width, height, channels, data, channels * width);
-        if (!img) {
-            spdlog::error("Failed to write file");
-        } else {
-            auto diff = time.duration<timer::milliseconds>();
-            spdlog::info("Write to file complete. Took {}", format(fg(color::aqua), "{:.2f}ms", diff));
-        }
+        return write_image(filename, to_image());
     }
 
     void fill(pixel col) {
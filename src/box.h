@@ -0,0 +1,172 @@
+#ifndef __BOX_H__
+#define __BOX_H__
+
+#include "rtweekend.h"
+#include "hittable.h"
+
+// A solid box found with a single slab test instead of six quads. The box spans a to b, is
+// optionally rotated about the y axis through the origin and then moved by offset, the same
+// as wrapping it in rotate_y and translate. Normals and uvs match what the six quads of the
+// old box() gave, so textures line up the same way.
+class box_primitive : public hittable {
+public:
+    box_primitive(const point3& a, const point3& b, shared_ptr<material> m, double angle = 0, const vec3& _offset = vec3(0, 0, 0))
+        : mat(m), offset(_offset), angle(angle)
+    {
+        for (int i = 0; i < 3; i += 1) {
+            lo[i] = fmin(a[i], b[i]);
+            hi[i] = fmax(a[i], b[i]);
+        }
+
+        auto radians = degrees_to_radians(angle);
+        sin_theta = sin(radians);
+        cos_theta = cos(radians);
+        rotated = angle != 0;
+
+        // bounds of the rotated corners
+        point3 min(infinity, infinity, infinity);
+        point3 max(-infinity, -infinity, -infinity);
+        for (int i = 0; i < 8; i += 1) {
+            auto corner = to_world(point3((i & 1) ? hi.x() : lo.x(), (i & 2) ? hi.y() : lo.y(), (i & 4) ? hi.z() : lo.z()));
+            for (int c = 0; c < 3; c += 1) {
+                min[c] = fmin(min[c], corner[c]);
+                max[c] = fmax(max[c], corner[c]);
+            }
+        }
+        bbox = aabb(min + offset, max + offset).pad();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        STAT_INC(box_tests);
+
+        // into box space
+        auto origin = to_local(r.origin() - offset);
+        auto direction = to_local(r.direction());
+
+        // entry is the last slab the ray enters, exit the first it leaves
+        auto t_enter = -infinity;
+        auto t_exit = infinity;
+        int enter_axis = 0;
+        int exit_axis = 0;
+
+        for (int a = 0; a < 3; a += 1) {
+            if (direction[a] == 0) {
+                // parallel to this slab, either always inside it or never
+                if (origin[a] < lo[a] || origin[a] > hi[a]) {
+                    return false;
+                }
+                continue;
+            }
+
+            auto inv_d = 1 / direction[a];
+            auto t0 = (lo[a] - origin[a]) * inv_d;
+            auto t1 = (hi[a] - origin[a]) * inv_d;
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+
+            if (t0 > t_enter) {
+                t_enter = t0;
+                enter_axis = a;
+            }
+            if (t1 < t_exit) {
+                t_exit = t1;
+                exit_axis = a;
+            }
+        }
+
+        if (t_enter > t_exit) {
+            return false;
+        }
+
+        // the entry face unless the ray starts inside the box, then the exit face
+        auto t = t_enter;
+        auto axis = enter_axis;
+        auto exiting = false;
+        if (!ray_t.contains(t)) {
+            t = t_exit;
+            axis = exit_axis;
+            exiting = true;
+            if (!ray_t.contains(t)) {
+                return false;
+            }
+        }
+
+        // the point is on the face's plane exactly in box space
+        auto local_p = origin + t * direction;
+
+        // the face is on the high side of the slab when the ray leaves through it going
+        // forwards, or enters it going backwards
+        auto on_high = exiting == (direction[axis] > 0);
+        vec3 outward_normal(0, 0, 0);
+        outward_normal[axis] = on_high ? 1 : -1;
+        local_p[axis] = on_high ? hi[axis] : lo[axis];
+
+        face_uv(local_p, axis, on_high, rec.u, rec.v);
+
+        rec.t = t;
+        rec.p = to_world(local_p) + offset;
+        rec.p_error = rounding_error(6) * (max_abs_component(local_p) + max_abs_component(offset));
+        rec.mat = mat;
+        rec.set_face_normal(r, to_world(outward_normal));
+
+        return true;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    bool clip_box(const aabb& region, aabb& clipped) const override {
+        clipped = overlap(bbox, region);
+        return true;
+    }
+
+    void draw(const draw_options& options) const override;
+
+private:
+    point3r lo;
+    point3r hi;
+    shared_ptr<material> mat;
+    vec3r offset;
+    double angle;
+    double sin_theta;
+    double cos_theta;
+    bool rotated;
+    aabb bbox;
+
+    vec3 to_local(const vec3& v) const {
+        if (!rotated) {
+            return v;
+        }
+        return vec3(cos_theta * v[0] - sin_theta * v[2], v[1], sin_theta * v[0] + cos_theta * v[2]);
+    }
+
+    vec3 to_world(const vec3& v) const {
+        if (!rotated) {
+            return v;
+        }
+        return vec3(cos_theta * v[0] + sin_theta * v[2], v[1], -sin_theta * v[0] + cos_theta * v[2]);
+    }
+
+    void face_uv(const point3& p, int axis, bool on_high, double& u, double& v) const {
+        // each face runs its u and v the way the matching quad of box() did
+        auto size = hi - lo;
+        auto fx = (p.x() - lo.x()) / size.x();
+        auto fy = (p.y() - lo.y()) / size.y();
+        auto fz = (p.z() - lo.z()) / size.z();
+
+        if (axis == 0) {
+            u = on_high ? 1 - fz : fz; // right, left
+            v = fy;
+        } else if (axis == 1) {
+            u = fx;
+            v = on_high ? 1 - fz : fz; // top, bottom
+        } else {
+            u = on_high ? fx : 1 - fx; // front, back
+            v = fy;
+        }
+    }
+};
+
+#endif//__BOX_H__
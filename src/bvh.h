@@ -4,18 +4,418 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "arena.h"
+#include "packet.h"
 
 #include <algorithm>
+#include <cmath>
 #include <spdlog/spdlog.h>
+#include <taskflow/taskflow.hpp>
 
 class bvh_node : public hittable {
 public:
-    bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
+    // with an arena every node is allocated from it, so the whole tree is packed together
+    bvh_node(const hittable_list& list, scene_arena* arena = nullptr) : root(true) {
+        auto objects = list.objects; // create modifiable array of source objects
+        build(objects, 0, objects.size(), arena);
+    }
 
-    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
-        spdlog::trace("Creating bvh node for hittalbes: [{}, {}]", start, end);
+    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, scene_arena* arena) {
+        build(objects, start, end, arena);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        STAT_INC(bvh_nodes_visited);
+
+        if (!bbox.hit(r, ray_t)) {
+            return false;
+        }
+
+        bool hit_left = left->hit(r, ray_t, rec);
+        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+        return hit_left || hit_right;
+    }
+
+    void hit_packet(ray_packet& packet, uint64_t active) const override {
+        STAT_INC(bvh_nodes_visited);
+
+        // one test culls the node for the whole packet
+        if (!packet.bounds.may_hit(bbox, packet.farthest(active))) {
+            STAT_INC(packet_culls);
+            return;
+        }
+
+        // then narrow it down to the rays that hit the box themselves
+        uint64_t hits = 0;
+        ray_packet::for_each(active, [&](int lane) {
+            if (bbox.hit(packet.rays[lane], interval(0, packet.closest[lane]))) {
+                hits |= uint64_t(1) << lane;
+            }
+        });
+
+        if (hits == 0) {
+            return;
+        }
+
+        if (ray_packet::count(hits) < packet.split_below) {
+            // the packet has lost coherence, the few rays left finish this subtree on their own
+            STAT_INC(packet_splits);
+            ray_packet::for_each(hits, [&](int lane) {
+                packet.hit_single(lane, *left);
+                if (right != left) {
+                    packet.hit_single(lane, *right);
+                }
+            });
+            return;
+        }
+
+        left->hit_packet(packet, hits);
+        if (right != left) {
+            right->hit_packet(packet, hits);
+        }
+    }
 
-        auto objects = src_objects; // create modifiable array of source objects
+    const hittable* packet_entry(const ray_bounds& bounds) const override {
+        // go down while the bounds only reach into one child
+        if (!bounds.may_hit(bbox)) {
+            return nullptr;
+        }
+
+        auto into_left = bounds.may_hit(left->bounding_box());
+        auto into_right = right != left && bounds.may_hit(right->bounding_box());
+        if (into_left && into_right) {
+            return this;
+        }
+        if (into_left) {
+            return left->packet_entry(bounds);
+        }
+        if (into_right) {
+            return right->packet_entry(bounds);
+        }
+        return nullptr;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    void draw(const draw_options& options) const override;
+
+    // memory the nodes of a tree over this many objects take, excluding the objects. build
+    // halves the objects until two or fewer are left, so the count only depends on that
+    static size_t bytes_used(size_t objects) {
+        if (objects <= 2) {
+            return sizeof(bvh_node);
+        }
+        return sizeof(bvh_node) + bytes_used(objects / 2) + bytes_used(objects - objects / 2);
+    }
+
+    bool animated() const override {
+        return dynamic;
+    }
+
+    // Moving objects are refitted rather than rebuilt: the tree keeps its shape and only the
+    // bounds on the path from an animated object to the root are recomputed. Static subtrees
+    // are never visited.
+    aabb prepare_frame(double time) override {
+        if (!dynamic) {
+            return bbox;
+        }
+
+        auto left_box = left->prepare_frame(time);
+        auto right_box = right == left ? left_box : right->prepare_frame(time);
+        next_bbox = aabb(left_box, right_box);
+        return next_bbox;
+    }
+
+    void commit_frame() override {
+        if (!dynamic) {
+            return;
+        }
+
+        left->commit_frame();
+        if (right != left) {
+            right->commit_frame();
+        }
+        bbox = next_bbox;
+
+        // nothing is tracing during a commit, so the root can see to the shape of the tree
+        if (root) {
+            auto rebuilt = optimize();
+            if (rebuilt > 0) {
+                spdlog::debug("Rebuilt {} bvh subtrees after objects moved", rebuilt);
+            }
+        }
+    }
+
+    // Edits, for objects that change other than along keyframes, like a sphere swapped for one
+    // somewhere else. Only make them while nothing is tracing the tree and not between a
+    // prepare_frame and its commit_frame, then optimize once they are done and refit whatever
+    // holds the tree, like the world's hittable_list.
+
+    // Swaps object, one of those the tree was built over, for replacement and refits the nodes
+    // above it, returning false if object isn't in the tree. The search only goes into nodes
+    // whose bounds hold the object's, so it has to still have the bounds it was last fitted to
+    bool replace(const hittable* object, shared_ptr<hittable> replacement) {
+        return replace(object, object->bounding_box(), replacement);
+    }
+
+    // fits every node to its objects again, for objects changed in place
+    aabb refit() {
+        if (left_node) {
+            node(left)->refit();
+        }
+        if (right_node) {
+            node(right)->refit();
+        }
+        fit();
+        return bbox;
+    }
+
+    // the same, with the subtrees under the nodes refit_levels down refitted in parallel as
+    // tasks of subflow, then the nodes above them fitted
+    aabb refit(tf::Subflow& subflow) {
+        spawn_refits(subflow, refit_levels);
+        subflow.join();
+        fit_above(refit_levels);
+        return bbox;
+    }
+
+    // Refitting keeps the shape the tree was built with, which gets worse the further objects
+    // move from where they were. optimize only looks at nodes above an edit or an animated
+    // object. Once the tree costs over rotate_ratio times what it did per ray when it was
+    // built, each of them swaps a child for a grandchild on the other side where that shrinks
+    // the child. Any that still cost over rebuild_ratio times what they did are built again.
+    // Returns how many subtrees were rebuilt
+    size_t optimize(double rotate_ratio = 1.05, double rebuild_ratio = 1.5) {
+        fit_edited();
+        if (cost_ratio() > rotate_ratio * build_ratio) {
+            rotate_edited();
+        }
+        return rebuild_degraded(rebuild_ratio);
+    }
+
+    // surface area cost, how many nodes and objects a ray that gets into the root is expected
+    // to test, now and when the tree was built
+    double cost_ratio() const {
+        auto area = bbox.area();
+        return area > 0 && std::isfinite(area) ? cost / area : 0;
+    }
+
+    double built_cost_ratio() const {
+        return build_ratio;
+    }
+
+    // the cost summed over the tree, each node weighted by its area rather than the root's
+    double surface_area_cost() const {
+        return cost;
+    }
+
+private:
+    static constexpr int refit_levels = 4; // so up to 32 subtrees, five levels down, refitted in parallel
+
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb bbox;
+    aabb next_bbox;
+    float cost = 0; // surface area cost of the subtree, see fit
+    float build_ratio = 0; // cost_ratio when built
+    bool dynamic = false; // an animated object is somewhere below this node
+    bool left_node = false; // left is a node of this tree rather than an object
+    bool right_node = false;
+    bool edited = false; // something below changed since the last optimize
+    bool root = false;
+
+    static bvh_node* node(const shared_ptr<hittable>& child) {
+        return static_cast<bvh_node*>(child.get());
+    }
+
+    // Bounds and cost from the children. Every ray that gets into a node tests both children,
+    // so a node costs its area for itself and again for every object under it, plus the cost
+    // of the nodes under it
+    void fit() {
+        bbox = aabb(left->bounding_box(), right->bounding_box());
+        dynamic = left->animated() || right->animated();
+        edited = true;
+
+        auto area = bbox.area();
+        auto objects = (left_node ? 0 : 1) + (right != left && !right_node ? 1 : 0);
+        double below = (left_node ? node(left)->cost : 0) + (right_node ? node(right)->cost : 0);
+        cost = static_cast<float>(area * (1 + objects) + below);
+    }
+
+    bool replace(const hittable* object, const aabb& box, const shared_ptr<hittable>& replacement) {
+        bool found = false;
+        if (left.get() == object && !left_node) {
+            left = replacement;
+            found = true;
+        } else if (left_node && node(left)->bbox.contains(box)) {
+            found = node(left)->replace(object, box, replacement);
+        }
+
+        if (right.get() == object && !right_node) {
+            right = replacement;
+            found = true;
+        } else if (!found && right_node && node(right)->bbox.contains(box)) {
+            found = node(right)->replace(object, box, replacement);
+        }
+
+        if (found) {
+            fit();
+        }
+        return found;
+    }
+
+    void spawn_refits(tf::Subflow& subflow, int levels) {
+        for (auto* child : { left_node ? node(left) : nullptr, right_node ? node(right) : nullptr }) {
+            if (child == nullptr) {
+                continue;
+            }
+            if (levels == 0) {
+                subflow.emplace([child]() {
+                    child->refit();
+                }).name("bvh refit");
+            } else {
+                child->spawn_refits(subflow, levels - 1);
+            }
+        }
+    }
+
+    void fit_above(int levels) {
+        if (levels > 0) {
+            if (left_node) {
+                node(left)->fit_above(levels - 1);
+            }
+            if (right_node) {
+                node(right)->fit_above(levels - 1);
+            }
+        }
+        fit();
+    }
+
+    // commit_frame only moves the bounds over, so the costs are worked out again first
+    void fit_edited() {
+        if (!edited && !dynamic) {
+            return;
+        }
+        if (left_node) {
+            node(left)->fit_edited();
+        }
+        if (right_node) {
+            node(right)->fit_edited();
+        }
+        fit();
+    }
+
+    void rotate_edited() {
+        if (!edited) {
+            return;
+        }
+
+        // children first, so a rotation here sees the bounds they settled on
+        if (left_node) {
+            node(left)->rotate_edited();
+        }
+        if (right_node) {
+            node(right)->rotate_edited();
+        }
+        rotate();
+        fit();
+    }
+
+    // Tree rotation: a child of one node trades places with a grandchild under the other, which
+    // leaves this node's bounds as they are and changes the bounds of the other. Takes the
+    // trade that shrinks it the most, if any does
+    void rotate() {
+        shared_ptr<hittable>* children[2] = { &left, &right };
+        bool* is_node[2] = { &left_node, &right_node };
+
+        double best = 0;
+        int best_side = -1;
+        int best_grandchild = 0;
+        for (int side = 0; side < 2; side += 1) {
+            if (!*is_node[side]) {
+                continue;
+            }
+
+            auto* child = node(*children[side]);
+            if (child->left == child->right) {
+                continue;
+            }
+
+            const auto& other = *children[1 - side];
+            auto before = child->bbox.area();
+            for (int g = 0; g < 2; g += 1) {
+                // other takes the place of grandchild g, leaving the child with the one beside it
+                const auto& stays = g == 0 ? child->right : child->left;
+                auto shrink = before - aabb(other->bounding_box(), stays->bounding_box()).area();
+                if (shrink > best) {
+                    best = shrink;
+                    best_side = side;
+                    best_grandchild = g;
+                }
+            }
+        }
+
+        if (best_side < 0) {
+            return;
+        }
+
+        auto* child = node(*children[best_side]);
+        auto& grandchild = best_grandchild == 0 ? child->left : child->right;
+        auto& grandchild_node = best_grandchild == 0 ? child->left_node : child->right_node;
+        std::swap(*children[1 - best_side], grandchild);
+        std::swap(*is_node[1 - best_side], grandchild_node);
+        child->fit();
+    }
+
+    size_t rebuild_degraded(double rebuild_ratio) {
+        if (!edited && !dynamic) {
+            return 0;
+        }
+        edited = false;
+
+        if ((left_node || right_node) && cost_ratio() > rebuild_ratio * build_ratio) {
+            // built again in place, so whatever holds this node still holds the tree. the new
+            // nodes are owned by the tree rather than an arena
+            std::vector<shared_ptr<hittable>> objects;
+            gather(objects);
+            build(objects, 0, objects.size(), nullptr);
+            return 1;
+        }
+
+        size_t rebuilt = 0;
+        if (left_node) {
+            rebuilt += node(left)->rebuild_degraded(rebuild_ratio);
+        }
+        if (right_node) {
+            rebuilt += node(right)->rebuild_degraded(rebuild_ratio);
+        }
+        if (rebuilt > 0) {
+            fit();
+            edited = false;
+        }
+        return rebuilt;
+    }
+
+    void gather(std::vector<shared_ptr<hittable>>& objects) const {
+        if (left_node) {
+            node(left)->gather(objects);
+        } else {
+            objects.push_back(left);
+        }
+        if (right_node) {
+            node(right)->gather(objects);
+        } else if (right != left) {
+            objects.push_back(right);
+        }
+    }
+
+    // sorts its range of objects in place and the children split it between them, sharing the
+    // one array rather than copying it for every node keeps building linear in memory
+    void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, scene_arena* arena) {
+        spdlog::trace("Creating bvh node for hittalbes: [{}, {}]", start, end);
 
         int axis = random_integer(0, 2);
         auto comparator = (axis == 0) ? box_x_compare
@@ -38,35 +438,23 @@ public:
             std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
             auto mid = start + object_span / 2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+            left = make_child(objects, start, mid, arena);
+            right = make_child(objects, mid, end, arena);
         }
 
-        bbox = aabb(left->bounding_box(), right->bounding_box());
+        left_node = right_node = object_span > 2;
+        fit();
+        edited = false;
+        build_ratio = static_cast<float>(cost_ratio());
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        if (!bbox.hit(r, ray_t)) {
-            return false;
+    static shared_ptr<hittable> make_child(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, scene_arena* arena) {
+        if (arena != nullptr) {
+            return arena->make<bvh_node>(objects, start, end, arena);
         }
-
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
-
-        return hit_left || hit_right;
-    }
-
-    aabb bounding_box() const override {
-        return bbox;
+        return make_shared<bvh_node>(objects, start, end, arena);
     }
 
-    void draw(const draw_options& options) const override;
-
-private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb bbox;
-
     static inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index) {
         return a->bounding_box().axis(axis_index).min < b->bounding_box().axis(axis_index).min;
     }
@@ -7,9 +7,27 @@
 #include "material.h"
 #include "bitmap.h"
 #include "timing.h"
+#include "accumulator.h"
+#include "checkpoint.h"
+#include "stats.h"
+#include "trace.h"
+#include "heatmap.h"
+#include "mpsc_queue.h"
+#include "gbuffer.h"
+#include "image_stream.h"
+#include "packet.h"
+#include "wavefront.h"
 
+#include <array>
+#include <atomic>
+#include <future>
 #include <thread>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include <cstring>
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bundled/color.h>
 #include <taskflow/taskflow.hpp>
@@ -21,6 +39,13 @@ struct chunk {
     int y2;
 };
 
+// a finished region of the image, copied out so the display can upload it without racing the workers
+struct tile_update {
+    chunk area;
+    uint64_t generation; // render that produced it, see camera::cancel
+    std::vector<pixel> pixels;
+};
+
 struct dimensions {
     int width;
     int height;
@@ -42,6 +67,38 @@ public:
     double defocus_angle = 0; // variation of angle of rays through each pixel
     double focus_dist = 10; // distance from camera lookfrom to perfect focus
 
+    uint64_t seed = 0; // when non-zero every pixel is seeded from it so renders are reproducible
+    uint64_t scene_hash = 0; // identifies the scene being rendered, used to validate checkpoints
+
+    render_mode mode = render_mode::beauty; // heatmap modes replace the image with per pixel cost
+
+    bool publish_tiles = false; // queue a copy of every finished tile for drain_tiles()
+
+    // above 1, trace one pixel per preview_scale x preview_scale block and fill the block with it.
+    // previews bypass the accumulator, checkpoints and heatmaps and only log at debug level
+    int preview_scale = 1;
+
+    // keep samples from the previous render when only the view changed, by reprojecting them
+    // through the primary hit of each pixel and checking the surface is still the same
+    bool reuse_samples = false;
+
+    // primary rays are traced in packets of packet_size x packet_size pixels, up to 8, and each
+    // tile culls the bvh for all of its packets at once. 1 traces every ray on its own. heatmaps
+    // always trace single rays so each cost lands on its own pixel
+    int packet_size = 8;
+
+    // render with the wavefront integrator, see path_buffer, instead of tracing each path to its
+    // end in turn. only for full renders of the image, previews, streaming, heatmaps and sample
+    // reuse always trace paths one at a time
+    bool wavefront = false;
+
+    // with the wavefront integrator, sort the paths by where they start and the way they head
+    // before every bounce after the first, so rays that visit the same nodes are traced together
+    bool sort_rays = false;
+
+    std::string checkpoint_file; // periodically save render state here when set
+    double checkpoint_interval = 30; // seconds between checkpoints
+
     void init() {
         initialize();
     }
@@ -50,74 +107,418 @@ public:
         return { image_width, image_height };
     }
 
+    void resume(checkpoint ckpt) {
+        // the checkpoint is validated against the camera state when the next render starts
+        seed = ckpt.header.seed;
+        pending_resume = std::move(ckpt);
+    }
+
+    bool resuming() const {
+        return pending_resume.has_value();
+    }
+
+    uint64_t state_hash() const {
+        // hash everything that affects the value of a sample, samples per pixel is left out so
+        // that a resumed render can be continued to a higher sample count
+        uint64_t h = hash_combine(scene_hash, seed);
+        h = hash_combine(h, image_width);
+        h = hash_combine(h, image_height);
+        h = hash_combine(h, max_depth);
+        h = hash_value(h, vfov);
+        h = hash_value(h, defocus_angle);
+        h = hash_value(h, focus_dist);
+        for (int i = 0; i < 3; i += 1) {
+            h = hash_value(h, lookfrom[i]);
+            h = hash_value(h, lookat[i]);
+            h = hash_value(h, vup[i]);
+            h = hash_value(h, background[i]);
+        }
+        return h;
+    }
+
     void render(const hittable& world, tf::Subflow& subflow, std::shared_ptr<bitmap> out_bmp) {
+        render(world, subflow, out_bmp, current_generation());
+    }
+
+    // renders as part of the given generation, tasks return as soon as cancel() moves past it
+    void render(const hittable& world, tf::Subflow& subflow, std::shared_ptr<bitmap> out_bmp, uint64_t gen) {
         using namespace fmt;
 
+        if (stale(gen)) {
+            return;
+        }
+
         timer time;
 
-        spdlog::info("Rendering scene...");
+        spdlog::log(log_level(), "Rendering scene...");
 
-        stopped = false;
-        done = false;
+        started_generation.store(gen, std::memory_order_release);
+        finished_generation.store(0, std::memory_order_release);
+        ray_count = 0;
+        stats::reset();
+        prepare_samples();
 
-        std::vector<chunk> chunks;
-        int chunk_size = 32;
-        for (int y = 0; y < image_height; y += chunk_size) {
-            for (int x = 0; x < image_width; x += chunk_size) {
-                chunks.emplace_back(chunk{ x, y, std::min(x + chunk_size, image_width), std::min(y + chunk_size, image_height) });
+        if (previewing()) {
+            render_preview(world, subflow, out_bmp, gen);
+            return;
+        }
+
+        tracking_hits = reuse_samples && mode == render_mode::beauty;
+        prepare_accumulator(*out_bmp, gen);
+        if (tracking_hits) {
+            primary_hits.resize(image_width, image_height);
+            history_key = 0; // until this render finishes, primary_hits are no history
+        }
+
+        if (mode != render_mode::beauty) {
+            pixel_cost.assign(static_cast<size_t>(image_width) * image_height, 0.0f);
+#if !ACE_ENABLE_STATS
+            if (mode != render_mode::heatmap_cycles) {
+                spdlog::warn("Built without ACE_ENABLE_STATS, only the cycles heatmap is available");
             }
+#endif
         }
 
-        std::random_device rd;
-        std::mt19937 g(rd());
-        std::shuffle(chunks.begin(), chunks.end(), g);
+        // stopped (and so flushed one last time) when it goes out of scope
+        std::unique_ptr<checkpoint_writer> writer;
+        if (!checkpoint_file.empty()) {
+            writer = std::make_unique<checkpoint_writer>(checkpoint_file, checkpoint_interval);
+            writer->start(accum, state_hash(), seed);
+        }
+
+        if (wavefront && !tracking_hits && mode == render_mode::beauty) {
+            emplace_waves(world, subflow, out_bmp, gen);
+        } else {
+            emplace_tiles(world, subflow, out_bmp, gen);
+        }
+
+        subflow.join();
+
+        if (reprojecting) {
+            log_reuse();
+            reprojecting = false;
+        }
+        // a cancelled render leaves primary_hits part filled, which mustn't pass for history
+        if (tracking_hits && !stale(gen)) {
+            history_key = reuse_key();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            last_stats = stats::collect();
+        }
+
+        if (stale(gen)) {
+            return;
+        }
+
+        if (mode != render_mode::beauty) {
+            write_heatmap(*out_bmp);
+            publish(chunk{ 0, 0, image_width, image_height }, *out_bmp, gen);
+        }
+
+        finished_generation.store(gen, std::memory_order_release);
+        auto diff = time.duration<timer::milliseconds>();
+        spdlog::info("Rendering completed in {}", format(fg(color::aqua), "{:.2f}ms", diff));
+        last_stats.log();
+    }
+
+    void emplace_tiles(const hittable& world, tf::Subflow& subflow, std::shared_ptr<bitmap> out_bmp, uint64_t gen) {
+        auto chunks = make_chunks();
+        if (reprojecting) {
+            order_by_disocclusion(chunks);
+        }
 
         for (auto& curr_chunk : chunks) {
-            for (int y = curr_chunk.y1; y < curr_chunk.y2 && !stopped; y += 1) {
-                timer row_time;
+            // one task per tile keeps scheduling overhead low and gives each tile a single zone
+            // in the trace, stopping is still checked for every packet
+            subflow.emplace([&world, curr_chunk, out_bmp, gen, this]() {
+                if (stale(gen)) {
+                    return;
+                }
 
-                for (int x = curr_chunk.x1; x < curr_chunk.x2 && !stopped; x += 1) {
-                    auto task = subflow.emplace([&, x, y, out_bmp, this]() {
-                        if (stopped) {
-                            return;
-                        }
+                trace_zone zone("tile");
+                zone.arg("x", curr_chunk.x1).arg("y", curr_chunk.y1);
+
+                stats::register_thread();
 
-                        colour pixel_colour(0, 0, 0);
-                        for (int sample = 0; sample < samples_per_pixel; sample += 1) {
-                            ray r = get_ray(x, y);
-                            pixel_colour += ray_colour(r, max_depth, world);
+                if (reprojecting) {
+                    trace_zone reproject_zone("reproject");
+                    adopt_history(curr_chunk, world, gen);
+                }
+
+                render_tile(curr_chunk, world, gen);
+
+                trace_zone resolve_zone("resolve");
+                resolve(curr_chunk, *out_bmp);
+                publish(curr_chunk, *out_bmp, gen);
+            }).name("tile");
+        }
+    }
+
+    void emplace_waves(const hittable& world, tf::Subflow& subflow, std::shared_ptr<bitmap> out_bmp, uint64_t gen) {
+        // Whole rows at a time while a row's paths fit in a wave, otherwise runs of pixels along
+        // a row. A pixel with more than wave_paths samples left gets them over several passes of
+        // its wave, each doing up to wave_samples of them, so a wave never holds more than
+        // wave_paths
+        auto wave_samples = std::clamp<size_t>(samples_per_pixel, 1, wave_paths);
+        auto row_paths = static_cast<size_t>(image_width) * wave_samples;
+        auto rows = static_cast<int>(std::clamp<size_t>(wave_paths / row_paths, 1, image_height));
+        auto columns = static_cast<int>(std::clamp<size_t>(wave_paths / wave_samples, 1, image_width));
+        auto passes = std::max(1, (samples_per_pixel + static_cast<int>(wave_samples) - 1) / static_cast<int>(wave_samples));
+        spdlog::debug("Rendering in waves of {} rows, {} columns, {} samples", rows, columns, wave_samples);
+
+        // sort_rays bins paths by cells of the scene's bounds
+        auto bounds = world.bounding_box();
+        auto& executor = subflow.executor();
+
+        // One task per wave, which takes its paths through every bounce. A wave waits for the
+        // one before it on the same buffer, so waves_in_flight of them run at once and the serial
+        // stages of one, compact, reorder and resolve, overlap the slices of the others
+        std::vector<tf::Task> waves;
+        for (int y0 = 0; y0 < image_height; y0 += rows) {
+            for (int x0 = 0; x0 < image_width; x0 += columns) {
+                auto area = chunk{ x0, y0, std::min(x0 + columns, image_width), std::min(y0 + rows, image_height) };
+                auto wave = waves.size();
+                auto& buffer = wave_buffers[wave % waves_in_flight];
+                auto key = hash_combine(sample_key, wave);
+
+                auto task = subflow.emplace([this, &executor, &world, &buffer, area, bounds, wave_samples, passes, key, out_bmp, gen]() {
+                    for (int pass = 0; pass < passes && !stale(gen); pass += 1) {
+                        render_wave(executor, world, buffer, area, bounds, wave_samples, hash_combine(key, pass), gen);
+                        if (!stale(gen)) {
+                            resolve(area, *out_bmp);
+                            publish(area, *out_bmp, gen);
                         }
+                    }
+                }).name("wave");
 
-                        pixel& px = out_bmp->pixel_at(x, y);
-                        write_colour(px, pixel_colour, samples_per_pixel);
-                        spdlog::trace("output pixel at ({}, {}) -> ({}, {}, {})", x, y, px.r, px.g, px.b);
-                    });
+                if (wave >= waves_in_flight) {
+                    waves[wave - waves_in_flight].precede(task);
                 }
+                waves.push_back(task);
             }
         }
+    }
+
+    void render_preview(const hittable& world, tf::Subflow& subflow, std::shared_ptr<bitmap> out_bmp, uint64_t gen) {
+        using namespace fmt;
+
+        timer time;
+
+        // tiles are 32 pixels so every power of two scale up to 32 lines up with them
+        for (auto& curr_chunk : make_chunks()) {
+            subflow.emplace([&, curr_chunk, out_bmp, this]() {
+                if (stale(gen)) {
+                    return;
+                }
+
+                trace_zone zone("preview tile");
+                zone.arg("x", curr_chunk.x1).arg("y", curr_chunk.y1).arg("scale", preview_scale);
+
+                stats::register_thread();
+
+                for (int y = curr_chunk.y1; y < curr_chunk.y2 && !stale(gen); y += preview_scale) {
+                    for (int x = curr_chunk.x1; x < curr_chunk.x2 && !stale(gen); x += preview_scale) {
+                        render_preview_block(x, y, world, *out_bmp, gen);
+                    }
+                }
+
+                if (!stale(gen)) {
+                    publish(curr_chunk, *out_bmp, gen);
+                }
+            }).name("preview tile");
+        }
 
         subflow.join();
 
-        if (stopped) {
+        if (stale(gen)) {
             return;
         }
 
-        done = true;
+        finished_generation.store(gen, std::memory_order_release);
+        auto diff = time.duration<timer::milliseconds>();
+        spdlog::debug("Preview at 1/{} resolution completed in {}", preview_scale, format(fg(color::aqua), "{:.2f}ms", diff));
+    }
+
+    // Renders the image in bands of rows and writes each band to the stream as soon as it is
+    // done, so only two bands are ever held in memory. The next band renders while the last
+    // one is written. Heatmaps, sample reuse and checkpoints need the whole frame and are
+    // not available here.
+    bool render_to_stream(const hittable& world, tf::Executor& executor, image_stream& out, int band_height = 64) {
+        using namespace fmt;
+
+        timer time;
+
+        auto gen = current_generation();
+        if (mode != render_mode::beauty || reuse_samples || !checkpoint_file.empty()) {
+            spdlog::warn("Heatmaps, sample reuse and checkpoints are ignored when streaming output");
+        }
+
+        spdlog::info("Rendering scene to stream in bands of {} rows...", band_height);
+
+        started_generation.store(gen, std::memory_order_release);
+        finished_generation.store(0, std::memory_order_release);
+        ray_count = 0;
+        stats::reset();
+        prepare_samples();
+
+        auto saved_mode = mode;
+        mode = render_mode::beauty;
+        tracking_hits = false;
+
+        // a band can be written while the one after it renders, so two are kept
+        std::unique_ptr<bitmap> bands[2];
+        std::future<bool> pending_write;
+        bool ok = true;
+
+        int band_index = 0;
+        for (int y0 = 0; y0 < image_height && !stale(gen) && ok; y0 += band_height, band_index += 1) {
+            auto y1 = std::min(y0 + band_height, image_height);
+
+            auto& band = bands[band_index % 2];
+            if (!band || band->height != y1 - y0) {
+                band = std::make_unique<bitmap>(image_width, y1 - y0);
+            }
+
+            band_y0 = y0;
+            accum.resize(image_width, y1 - y0);
+
+            tf::Taskflow band_flow;
+            for (auto& curr_chunk : make_chunks(y0, y1)) {
+                band_flow.emplace([&, curr_chunk, gen, this]() {
+                    if (stale(gen)) {
+                        return;
+                    }
+
+                    trace_zone zone("tile");
+                    zone.arg("x", curr_chunk.x1).arg("y", curr_chunk.y1);
+
+                    stats::register_thread();
+
+                    render_tile(curr_chunk, world, gen);
+
+                    resolve(curr_chunk, *band);
+                }).name("tile");
+            }
+
+            // the previous band's write overlaps with this band rendering
+            auto rendered = executor.run(band_flow);
+            rendered.wait();
+
+            if (pending_write.valid()) {
+                ok = pending_write.get();
+            }
+            if (!ok || stale(gen)) {
+                break;
+            }
+
+            auto* finished_band = band.get();
+            pending_write = std::async(std::launch::async, [&out, finished_band]() {
+                trace_zone zone("band write", "io");
+                return out.write_rows(finished_band->data, finished_band->height);
+            });
+
+            spdlog::debug("Rendered rows {} to {}", y0, y1);
+        }
+
+        if (pending_write.valid()) {
+            ok = pending_write.get() && ok;
+        }
+
+        band_y0 = 0;
+        accum.resize(0, 0);
+        mode = saved_mode;
+
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            last_stats = stats::collect();
+        }
+
+        if (stale(gen) || !ok) {
+            return false;
+        }
+
+        finished_generation.store(gen, std::memory_order_release);
         auto diff = time.duration<timer::milliseconds>();
         spdlog::info("Rendering completed in {}", format(fg(color::aqua), "{:.2f}ms", diff));
+        last_stats.log();
+        return true;
     }
 
-    void cancel() {
-        stopped = true;
-        done = false;
+    // called from a single consumer thread, hands over tiles in the order they were finished
+    template<typename F>
+    size_t drain_tiles(F&& fn) {
+        return completed_tiles.drain(std::forward<F>(fn));
+    }
+
+    void discard_tiles() {
+        completed_tiles.clear();
+    }
+
+    // copies a finished frame for writing out, along with the linear colour of every pixel
+    // for float formats unless with_hdr is false. only call once the render is complete
+    image_buffer capture_image(const bitmap& bmp, bool with_hdr = true) const {
+        auto image = bmp.to_image();
+        if (!with_hdr || accum.width() != image.width || accum.height() != image.height) {
+            return image;
+        }
+
+        image.hdr.assign(static_cast<size_t>(image.width) * image.height * 3, 0.0f);
+        for (int y = 0; y < image.height; y += 1) {
+            for (int x = 0; x < image.width; x += 1) {
+                auto count = accum.count_at(x, y);
+                if (count == 0) {
+                    continue;
+                }
+
+                auto c = accum.sum_at(x, y) / count;
+                auto i = (static_cast<size_t>(y) * image.width + x) * 3;
+                image.hdr[i + 0] = static_cast<float>(c.x());
+                image.hdr[i + 1] = static_cast<float>(c.y());
+                image.hdr[i + 2] = static_cast<float>(c.z());
+            }
+        }
+        return image;
+    }
+
+    // publishes the whole bitmap as one tile for the given generation, e.g. after clearing it
+    void publish_image(bitmap& bmp, uint64_t gen) {
+        publish(chunk{ 0, 0, image_width, image_height }, bmp, gen);
+    }
+
+    // Cancelling never waits: it moves the generation on, and every task of an older generation
+    // returns the next time it checks, which is at least once per packet. Returns the new
+    // generation, which the next render picks up.
+    uint64_t cancel() {
+        return generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+
+    uint64_t current_generation() const {
+        return generation.load(std::memory_order_acquire);
     }
 
     bool rendering() const {
-        return !stopped;
+        return started_generation.load(std::memory_order_acquire) == current_generation();
     }
 
     bool complete() const {
-        return done;
+        return finished_generation.load(std::memory_order_acquire) == current_generation();
+    }
+
+    bool previewing() const {
+        return preview_scale > 1;
+    }
+
+    render_stats statistics() const {
+        // counters merged from every worker at the end of the last render
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        return last_stats;
+    }
+
+    uint64_t rays_traced() const {
+        // camera and scattered rays traced by the last render
+        return ray_count.load(std::memory_order_relaxed);
     }
 
 private:
@@ -130,13 +531,57 @@ private:
     vec3    defocus_disk_u;
     vec3    defocus_disk_v;
 
-    bool stopped = true;
-    bool done = false;
+    // generation 0 is never current, so a fresh camera is neither rendering nor complete
+    std::atomic<uint64_t> generation{1};
+    std::atomic<uint64_t> started_generation{0};
+    std::atomic<uint64_t> finished_generation{0};
+
+    accumulator accum;
+    int band_y0 = 0; // first image row held by accum, only non-zero when streaming
+    std::optional<checkpoint> pending_resume;
+    std::atomic<uint64_t> ray_count{0};
+
+    // the camera samples of a pixel come from this and the pixel, see get_ray
+    uint64_t sample_key = 0;
+
+    // how many samples of each pixel in a packet are made and traced ahead of shading them,
+    // which bounds the memory held by packets waiting to be shaded
+    static constexpr int samples_per_batch = 16;
+
+    // the wavefront integrator's paths, up to wave_paths in each of waves_in_flight waves that
+    // run at once. stages hand out slices of slice_paths paths to each task
+    static constexpr size_t wave_paths = size_t(1) << 16;
+    static constexpr size_t waves_in_flight = 4;
+    static constexpr size_t slice_paths = 2048;
+
+    // a wave's paths and the first path of every pixel in it
+    struct wave_buffer {
+        path_buffer paths;
+        std::vector<uint32_t> offsets;
+    };
+    std::array<wave_buffer, waves_in_flight> wave_buffers;
+
+    std::vector<float> pixel_cost;
+
+    // primary hits of the current render, and the samples and hits of the render before it
+    bool tracking_hits = false;
+    bool reprojecting = false;
+    gbuffer primary_hits;
+    accumulator history;
+    gbuffer history_hits;
+    uint64_t history_key = 0;
+    std::vector<int32_t> history_source; // previous pixel reprojected onto each pixel, or -1
+    std::atomic<uint64_t> pixels_reused{0};
+
+    mpsc_queue<tile_update> completed_tiles;
+
+    mutable std::mutex stats_mutex;
+    render_stats last_stats;
 
     void initialize() {
         using namespace fmt;
 
-        spdlog::info("Initializing camera:");
+        spdlog::log(log_level(), "Initializing camera:");
 
         image_height = static_cast<int>(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height;
@@ -172,12 +617,604 @@ private:
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
 
-        spdlog::info("  image dimensions: {}", format(fg(color::aqua), "{} x {}", image_width, image_height));
-        spdlog::info("  samples per pixel: {}", styled(samples_per_pixel, fg(color::aqua)));
-        spdlog::info("  max depth: {}", styled(max_depth, fg(color::aqua)));
+        spdlog::log(log_level(), "  image dimensions: {}", format(fg(color::aqua), "{} x {}", image_width, image_height));
+        spdlog::log(log_level(), "  samples per pixel: {}", styled(samples_per_pixel, fg(color::aqua)));
+        spdlog::log(log_level(), "  max depth: {}", styled(max_depth, fg(color::aqua)));
+    }
+
+    static uint64_t hash_value(uint64_t h, double value) {
+        // values are rounded to float since the viewport camera round trips them through raylib
+        float f = static_cast<float>(value);
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return hash_combine(h, bits);
+    }
+
+    uint64_t reuse_key() const {
+        // like state_hash but without the view, samples can only be reused if this matches
+        uint64_t h = hash_combine(scene_hash, image_width);
+        h = hash_combine(h, image_height);
+        h = hash_combine(h, max_depth);
+        h = hash_value(h, defocus_angle);
+        h = hash_value(h, focus_dist);
+        for (int i = 0; i < 3; i += 1) {
+            h = hash_value(h, background[i]);
+        }
+        return h;
+    }
+
+    bool has_history() const {
+        return history_key == reuse_key() && primary_hits.width() == image_width && primary_hits.height() == image_height;
+    }
+
+    void reproject_history() {
+        trace_zone zone("reproject history");
+
+        // forward project every previous primary hit into the new view, keeping the closest
+        // one per pixel. the tiles check each candidate against a fresh primary ray later
+        auto num_pixels = static_cast<size_t>(image_width) * image_height;
+        history_source.assign(num_pixels, -1);
+        std::vector<double> closest(num_pixels, infinity);
+
+        auto du_len2 = pixel_delta_u.length_squared();
+        auto dv_len2 = pixel_delta_v.length_squared();
+
+        for (int y = 0; y < image_height; y += 1) {
+            for (int x = 0; x < image_width; x += 1) {
+                if (history.count_at(x, y) == 0 || !history_hits.has_hit(x, y)) {
+                    continue;
+                }
+
+                auto d = history_hits.position_at(x, y) - center;
+                auto forward = dot(d, -w);
+                if (forward <= 0) {
+                    continue;
+                }
+
+                auto on_plane = center + d * (focus_dist / forward) - pixel00_loc;
+                auto nx = static_cast<int>(std::lround(dot(on_plane, pixel_delta_u) / du_len2));
+                auto ny = static_cast<int>(std::lround(dot(on_plane, pixel_delta_v) / dv_len2));
+                if (nx < 0 || nx >= image_width || ny < 0 || ny >= image_height) {
+                    continue;
+                }
+
+                auto i = static_cast<size_t>(ny) * image_width + nx;
+                auto dist = d.length_squared();
+                if (dist < closest[i]) {
+                    closest[i] = dist;
+                    history_source[i] = static_cast<int32_t>(static_cast<size_t>(y) * image_width + x);
+                }
+            }
+        }
+
+        pixels_reused = 0;
+        reprojecting = true;
     }
 
-    colour ray_colour(const ray& r, int depth, const hittable& world) const {
+    void order_by_disocclusion(std::vector<chunk>& chunks) const {
+        // tiles with the fewest reprojected pixels have the most new work, render them first
+        auto missing = [this](const chunk& area) {
+            int count = 0;
+            for (int y = area.y1; y < area.y2; y += 1) {
+                for (int x = area.x1; x < area.x2; x += 1) {
+                    count += history_source[static_cast<size_t>(y) * image_width + x] < 0;
+                }
+            }
+            return count;
+        };
+
+        std::vector<std::pair<int, chunk>> keyed;
+        keyed.reserve(chunks.size());
+        for (const auto& area : chunks) {
+            keyed.emplace_back(missing(area), area);
+        }
+        std::stable_sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        for (size_t i = 0; i < chunks.size(); i += 1) {
+            chunks[i] = keyed[i].second;
+        }
+    }
+
+    bool stale(uint64_t gen) const {
+        return generation.load(std::memory_order_relaxed) != gen;
+    }
+
+    void adopt_history(const chunk& area, const hittable& world, uint64_t gen) {
+        // keep a reprojected pixel only if a ray through the new pixel center still lands on
+        // the same surface, otherwise it was occluded or is on a different object
+        uint64_t reused = 0;
+        for (int y = area.y1; y < area.y2 && !stale(gen); y += 1) {
+            for (int x = area.x1; x < area.x2 && !stale(gen); x += 1) {
+                auto source = history_source[static_cast<size_t>(y) * image_width + x];
+                if (source < 0) {
+                    continue;
+                }
+
+                auto sx = source % image_width;
+                auto sy = source / image_width;
+
+                auto pixel_center = pixel00_loc + (x * pixel_delta_u) + (y * pixel_delta_v);
+                ray r(center, pixel_center - center, 0.0);
+                STAT_INC(camera_rays);
+
+                hit_record rec;
+                if (!world.hit(r, interval(0, infinity), rec)) {
+                    continue;
+                }
+
+                auto old_p = history_hits.position_at(sx, sy);
+                auto tolerance = 0.01 * (rec.p - center).length();
+                if ((rec.p - old_p).length() > tolerance || dot(rec.normal, history_hits.normal_at(sx, sy)) < 0.9) {
+                    continue;
+                }
+
+                accum.add(x, y, history.sum_at(sx, sy), history.count_at(sx, sy));
+                primary_hits.set(x, y, primary_hit{ rec.p, rec.normal, true });
+                reused += 1;
+            }
+        }
+        pixels_reused.fetch_add(reused, std::memory_order_relaxed);
+    }
+
+    void log_reuse() const {
+        using namespace fmt;
+
+        auto num_pixels = static_cast<double>(image_width) * image_height;
+        auto reused = pixels_reused.load(std::memory_order_relaxed);
+        spdlog::info("Reused samples for {} pixels from the previous view", format(fg(color::aqua), "{} ({:.1f}%)", reused, 100.0 * reused / num_pixels));
+    }
+
+    spdlog::level::level_enum log_level() const {
+        // previews restart on every camera move, so keep them out of the default log
+        return previewing() ? spdlog::level::debug : spdlog::level::info;
+    }
+
+    std::vector<chunk> make_chunks() const {
+        return make_chunks(0, image_height);
+    }
+
+    std::vector<chunk> make_chunks(int y_begin, int y_end) const {
+        std::vector<chunk> chunks;
+        int chunk_size = 32;
+        for (int y = y_begin; y < y_end; y += chunk_size) {
+            for (int x = 0; x < image_width; x += chunk_size) {
+                chunks.emplace_back(chunk{ x, y, std::min(x + chunk_size, image_width), std::min(y + chunk_size, y_end) });
+            }
+        }
+
+        std::random_device rd;
+        std::mt19937 g(rd());
+        std::shuffle(chunks.begin(), chunks.end(), g);
+        return chunks;
+    }
+
+    void render_preview_block(int x, int y, const hittable& world, bitmap& bmp, uint64_t gen) {
+        auto x2 = std::min(x + preview_scale, image_width);
+        auto y2 = std::min(y + preview_scale, image_height);
+
+        if (seed != 0) {
+            seed_random(hash_combine(seed, static_cast<uint64_t>(y) * image_width + x));
+        }
+
+        // sample through the middle of the block
+        auto sx = (x + x2) / 2;
+        auto sy = (y + y2) / 2;
+
+        colour pixel_colour(0, 0, 0);
+        uint64_t rays = 0;
+        for (int sample = 0; sample < samples_per_pixel; sample += 1) {
+            // a block can take thousands of samples, a restart shouldn't wait for all of them
+            if (stale(gen)) {
+                ray_count.fetch_add(rays, std::memory_order_relaxed);
+                return;
+            }
+            STAT_INC(camera_rays);
+            pixel_colour += ray_colour(get_ray(sx, sy, sample), max_depth, world, rays);
+        }
+        ray_count.fetch_add(rays, std::memory_order_relaxed);
+
+        pixel block;
+        write_colour(block, pixel_colour, samples_per_pixel);
+        for (int by = y; by < y2; by += 1) {
+            for (int bx = x; bx < x2; bx += 1) {
+                bmp.pixel_at(bx, by) = block;
+            }
+        }
+    }
+
+    void prepare_samples() {
+        // with a seed the camera samples repeat from one render to the next
+        if (seed != 0) {
+            sample_key = hash_combine(seed, 0);
+        } else {
+            std::random_device rd;
+            sample_key = (static_cast<uint64_t>(rd()) << 32) | rd();
+        }
+    }
+
+    uint64_t pixel_index(int x, int y) const {
+        return static_cast<uint64_t>(y) * image_width + x;
+    }
+
+    ray_bounds tile_bounds(const chunk& area) const {
+        // every sample is within half a pixel of its pixel's centre and starts on the defocus disk
+        vec3 lens(0, 0, 0);
+        if (defocus_angle > 0) {
+            for (int a = 0; a < 3; a += 1) {
+                lens[a] = fabs(defocus_disk_u[a]) + fabs(defocus_disk_v[a]);
+            }
+        }
+
+        point3 p_min(infinity, infinity, infinity);
+        point3 p_max(-infinity, -infinity, -infinity);
+        for (auto i : { area.x1 - 0.5, area.x2 - 0.5 }) {
+            for (auto j : { area.y1 - 0.5, area.y2 - 0.5 }) {
+                auto p = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
+                for (int a = 0; a < 3; a += 1) {
+                    p_min[a] = fmin(p_min[a], p[a]);
+                    p_max[a] = fmax(p_max[a], p[a]);
+                }
+            }
+        }
+
+        return ray_bounds(center - lens, center + lens, p_min - (center + lens), p_max - (center - lens));
+    }
+
+    void render_wave(tf::Executor& executor, const hittable& world, wave_buffer& wave, const chunk& area, const aabb& bounds, size_t wave_samples, uint64_t key, uint64_t gen) {
+        // each stage spreads its work over slices of the wave's paths and waits for them
+        stats::register_thread();
+        auto& paths = wave.paths;
+        auto pixels = static_cast<size_t>(area.x2 - area.x1) * (area.y2 - area.y1);
+        auto pixels_per_slice = std::max<size_t>(1, slice_paths / wave_samples);
+
+        auto count = start_wave(wave, area, wave_samples);
+        STAT_ADD(paths, count);
+        for_each_slice(executor, pixels, pixels_per_slice, key, [this, &wave, &area](size_t begin, size_t end) {
+            generate_paths(wave, area, begin, end);
+        });
+
+        for (int bounce = 0; bounce <= max_depth && paths.live() > 0; bounce += 1) {
+            if (stale(gen)) {
+                return;
+            }
+
+            auto live = paths.live();
+            auto bounce_key = hash_combine(key, bounce);
+            ray_count.fetch_add(live, std::memory_order_relaxed);
+            STAT_ADD(total_path_depth, live);
+            STAT_MAX(max_path_depth, bounce + 1);
+
+            for_each_slice(executor, live, slice_paths, bounce_key, [&paths, &world](size_t begin, size_t end) {
+                paths.extend(world, begin, end);
+            });
+            for_each_slice(executor, live, slice_paths, bounce_key, [&paths](size_t begin, size_t end) {
+                paths.sort_by_material(begin, end);
+            });
+            auto last_bounce = bounce == max_depth;
+            for_each_slice(executor, live, slice_paths, ~bounce_key, [this, &paths, last_bounce](size_t begin, size_t end) {
+                paths.shade(background, last_bounce, begin, end);
+            });
+
+            paths.compact();
+            if (sort_rays && bounce < max_depth) {
+                paths.reorder(bounds);
+            }
+        }
+
+        if (stale(gen)) {
+            return;
+        }
+        for_each_slice(executor, pixels, pixels_per_slice, key, [this, &wave, &area](size_t begin, size_t end) {
+            retire_paths(wave, area, begin, end);
+        });
+    }
+
+    template<typename F>
+    void for_each_slice(tf::Executor& executor, size_t count, size_t slice, uint64_t key, const F& fn) {
+        // Each slice is seeded from where it starts, so with a seed a wave renders the same
+        // whichever threads its slices run on. The caller runs other tasks until they're done,
+        // or does a lone slice itself
+        auto run = [this, key, &fn](size_t begin, size_t end) {
+            stats::register_thread();
+            if (seed != 0) {
+                seed_random(hash_combine(key, begin));
+            }
+            fn(begin, end);
+        };
+
+        if (count <= slice) {
+            if (count > 0) {
+                run(0, count);
+            }
+            return;
+        }
+
+        tf::Taskflow stage;
+        for (size_t begin = 0; begin < count; begin += slice) {
+            auto end = std::min(begin + slice, count);
+            stage.emplace([&run, begin, end]() {
+                run(begin, end);
+            }).name("slice");
+        }
+        executor.corun(stage);
+    }
+
+    size_t start_wave(wave_buffer& wave, const chunk& area, size_t max_samples) {
+        // every pixel gets a run of paths, one for each sample it still needs, up to max_samples
+        auto width = area.x2 - area.x1;
+        auto pixels = static_cast<size_t>(width) * (area.y2 - area.y1);
+        wave.offsets.resize(pixels + 1);
+
+        uint32_t count = 0;
+        for (size_t p = 0; p < pixels; p += 1) {
+            wave.offsets[p] = count;
+            auto done = accum.count_at(area.x1 + static_cast<int>(p % width), area.y1 + static_cast<int>(p / width) - band_y0);
+            count += static_cast<uint32_t>(std::min<size_t>(std::max(0, samples_per_pixel - done), max_samples));
+        }
+        wave.offsets[pixels] = count;
+
+        wave.paths.resize(count);
+        return count;
+    }
+
+    void generate_paths(wave_buffer& wave, const chunk& area, size_t begin, size_t end) {
+        auto width = area.x2 - area.x1;
+        for (auto p = begin; p < end; p += 1) {
+            auto x = area.x1 + static_cast<int>(p % width);
+            auto y = area.y1 + static_cast<int>(p / width);
+            // the samples carry on from those earlier passes added to the pixel
+            auto first = accum.count_at(x, y - band_y0);
+            for (auto i = wave.offsets[p]; i < wave.offsets[p + 1]; i += 1) {
+                wave.paths.start(i, get_ray(x, y, first + static_cast<int>(i - wave.offsets[p])));
+                STAT_INC(camera_rays);
+            }
+        }
+    }
+
+    void retire_paths(wave_buffer& wave, const chunk& area, size_t begin, size_t end) {
+        auto width = area.x2 - area.x1;
+        for (auto p = begin; p < end; p += 1) {
+            auto count = wave.offsets[p + 1] - wave.offsets[p];
+            if (count == 0) {
+                continue;
+            }
+
+            colour sum(0, 0, 0);
+            for (auto i = wave.offsets[p]; i < wave.offsets[p + 1]; i += 1) {
+                sum += wave.paths.radiance(i);
+            }
+            accum.add(area.x1 + static_cast<int>(p % width), area.y1 + static_cast<int>(p / width) - band_y0, sum, count);
+        }
+    }
+
+    void render_tile(const chunk& area, const hittable& world, uint64_t gen) {
+        auto size = mode == render_mode::beauty ? std::clamp(packet_size, 1, 8) : 1;
+
+        // every packet in the tile starts from the deepest node whose siblings the tile's
+        // frustum misses, rather than from the root
+        const hittable* entry = size > 1 ? world.packet_entry(tile_bounds(area)) : &world;
+
+        for (int y = area.y1; y < area.y2 && !stale(gen); y += size) {
+            for (int x = area.x1; x < area.x2 && !stale(gen); x += size) {
+                render_block(chunk{ x, y, std::min(x + size, area.x2), std::min(y + size, area.y2) }, world, entry, gen);
+            }
+        }
+    }
+
+    // Renders a block of pixels, one lane of a packet each. The primary rays of up to
+    // samples_per_batch samples of every pixel are made and traced a packet per sample, then
+    // each pixel shades its samples in order. Shading draws from the thread's generator, which
+    // is seeded for each pixel and batch, so the image doesn't depend on the packet size except
+    // where a camera ray passes through a medium, which draws while the packet is traced.
+    void render_block(const chunk& block, const hittable& world, const hittable* entry, uint64_t gen) {
+        thread_local std::vector<ray_packet> packets(samples_per_batch);
+
+        auto width = block.x2 - block.x1;
+        auto lanes = width * (block.y2 - block.y1);
+
+        int first[ray_packet::max_rays];
+        colour sums[ray_packet::max_rays];
+        colour batch_sums[ray_packet::max_rays];
+        int remaining = 0;
+        for (int lane = 0; lane < lanes; lane += 1) {
+            first[lane] = accum.count_at(block.x1 + lane % width, block.y1 + lane / width - band_y0);
+            sums[lane] = colour(0, 0, 0);
+            batch_sums[lane] = colour(0, 0, 0);
+            remaining = std::max(remaining, samples_per_pixel - first[lane]);
+        }
+        if (remaining <= 0) {
+            return;
+        }
+
+        auto stats_before = stats::local;
+        auto cycles_before = read_cycle_counter();
+
+        uint64_t rays = 0;
+        int done = 0;
+        for (int batch = 0; batch < remaining && !stale(gen); batch += samples_per_batch) {
+            auto slots = std::min(samples_per_batch, remaining - batch);
+
+            // media draw random numbers while primary rays are traced, keep those repeatable too
+            if (seed != 0) {
+                seed_random(hash_combine(hash_combine(sample_key, pixel_index(block.x1, block.y1)), batch));
+            }
+
+            // a cancelled batch is dropped whole, so a pixel's sums always go with its count
+            for (int slot = 0; slot < slots && !stale(gen); slot += 1) {
+                auto& packet = packets[slot];
+                packet.clear();
+                for (int lane = 0; lane < lanes; lane += 1) {
+                    auto sample = first[lane] + batch + slot;
+                    if (sample < samples_per_pixel) {
+                        packet.set(lane, get_ray(block.x1 + lane % width, block.y1 + lane / width, sample));
+                        STAT_INC(camera_rays);
+                    }
+                }
+                trace_packet(packet, entry);
+            }
+
+            for (int lane = 0; lane < lanes && !stale(gen); lane += 1) {
+                auto x = block.x1 + lane % width;
+                auto y = block.y1 + lane / width;
+                auto begin = first[lane] + batch;
+                if (begin >= samples_per_pixel) {
+                    continue;
+                }
+
+                if (seed != 0) {
+                    seed_random(hash_combine(hash_combine(seed, pixel_index(x, y)), begin));
+                }
+
+                primary_hit first_hit;
+                bool record_hit = tracking_hits && begin == 0;
+
+                for (int slot = 0; slot < slots && begin + slot < samples_per_pixel && !stale(gen); slot += 1) {
+                    auto path_start = rays;
+                    batch_sums[lane] += primary_colour(packets[slot], lane, world, rays, record_hit && slot == 0 ? &first_hit : nullptr);
+
+                    STAT_INC(paths);
+                    STAT_ADD(total_path_depth, rays - path_start);
+                    STAT_MAX(max_path_depth, rays - path_start);
+                }
+
+                if (record_hit) {
+                    primary_hits.set(x, y, first_hit);
+                }
+            }
+
+            if (stale(gen)) {
+                break;
+            }
+            for (int lane = 0; lane < lanes; lane += 1) {
+                sums[lane] += batch_sums[lane];
+                batch_sums[lane] = colour(0, 0, 0);
+            }
+            done = batch + slots;
+        }
+
+        int samples = 0;
+        for (int lane = 0; lane < lanes; lane += 1) {
+            auto count = std::clamp(samples_per_pixel - first[lane], 0, done);
+            if (count > 0) {
+                accum.add(block.x1 + lane % width, block.y1 + lane / width - band_y0, sums[lane], count);
+                samples += count;
+            }
+        }
+        ray_count.fetch_add(rays, std::memory_order_relaxed);
+
+        if (mode != render_mode::beauty) {
+            double cost = 0;
+            switch (mode) {
+                case render_mode::heatmap_nodes:
+                    cost = stats::local.bvh_nodes_visited - stats_before.bvh_nodes_visited;
+                    break;
+                case render_mode::heatmap_primitives:
+                    cost = stats::local.primitive_tests() - stats_before.primitive_tests();
+                    break;
+                case render_mode::heatmap_cycles:
+                    cost = read_cycle_counter() - cycles_before;
+                    break;
+                default:
+                    break;
+            }
+
+            // blocks are single pixels for heatmaps
+            pixel_cost[pixel_index(block.x1, block.y1)] = samples > 0 ? cost / samples : 0;
+        }
+    }
+
+    static void trace_packet(ray_packet& packet, const hittable* entry) {
+        if (entry == nullptr) {
+            return; // the tile's frustum misses the whole scene
+        }
+
+        if (ray_packet::count(packet.lanes) < packet.split_below) {
+            ray_packet::for_each(packet.lanes, [&](int lane) { packet.hit_single(lane, *entry); });
+            return;
+        }
+
+        STAT_INC(packets);
+        packet.close();
+        entry->hit_packet(packet, packet.lanes);
+    }
+
+    void write_heatmap(bitmap& bmp) const {
+        auto summary = summarize_costs(pixel_cost);
+        log_heatmap_summary(mode, summary);
+
+        // scale to the 99th percentile so a handful of outliers don't wash out the image
+        auto scale = summary.histogram_max;
+        for (int y = 0; y < image_height; y += 1) {
+            for (int x = 0; x < image_width; x += 1) {
+                auto cost = pixel_cost[static_cast<size_t>(y) * image_width + x];
+                auto c = heatmap_colour(scale > 0 ? cost / scale : 0);
+
+                pixel& px = bmp.pixel_at(x, y);
+                px.r = static_cast<uint8_t>(255.999 * c.x());
+                px.g = static_cast<uint8_t>(255.999 * c.y());
+                px.b = static_cast<uint8_t>(255.999 * c.z());
+                px.a = 255;
+            }
+        }
+    }
+
+    void resolve(const chunk& area, bitmap& bmp) const {
+        // convert accumulated samples to display pixels, a row at a time
+        auto width = static_cast<size_t>(area.x2 - area.x1);
+        thread_local std::vector<float> sums;
+        thread_local std::vector<uint32_t> counts;
+        sums.resize(width * 3);
+        counts.resize(width);
+
+        for (int y = area.y1; y < area.y2; y += 1) {
+            accum.read_row(area.x1, area.x2, y - band_y0, sums.data(), counts.data());
+            write_colours(&bmp.pixel_at(area.x1, y - band_y0), sums.data(), counts.data(), width);
+        }
+    }
+
+    void publish(const chunk& area, bitmap& bmp, uint64_t gen) {
+        if (!publish_tiles) {
+            return;
+        }
+
+        auto width = area.x2 - area.x1;
+        tile_update tile{ area, gen, std::vector<pixel>(static_cast<size_t>(width) * (area.y2 - area.y1)) };
+        for (int y = area.y1; y < area.y2; y += 1) {
+            std::memcpy(&tile.pixels[static_cast<size_t>(y - area.y1) * width], &bmp.pixel_at(area.x1, y), width * sizeof(pixel));
+        }
+        completed_tiles.push(std::move(tile));
+    }
+
+    void prepare_accumulator(bitmap& bmp, uint64_t gen) {
+        if (pending_resume) {
+            auto ckpt = std::move(*pending_resume);
+            pending_resume.reset();
+
+            if (ckpt.state.width == image_width && ckpt.state.height == image_height && ckpt.header.scene_hash == state_hash()) {
+                accum.restore(ckpt.state);
+                resolve(chunk{ 0, 0, image_width, image_height }, bmp);
+                publish(chunk{ 0, 0, image_width, image_height }, bmp, gen);
+
+                spdlog::info("Resuming render from checkpoint with {} samples", ckpt.header.sample_index);
+                return;
+            }
+
+            spdlog::warn("Checkpoint does not match the current scene and camera, starting a new render");
+        }
+
+        if (tracking_hits && has_history()) {
+            // the last render becomes the history, it is reprojected into the new view
+            std::swap(history, accum);
+            std::swap(history_hits, primary_hits);
+            accum.resize(image_width, image_height);
+            reproject_history();
+            return;
+        }
+
+        accum.resize(image_width, image_height);
+    }
+
+    colour ray_colour(const ray& r, int depth, const hittable& world, uint64_t& rays, primary_hit* first_hit = nullptr) const {
         hit_record rec;
 
         // no more bounces, no more light
@@ -185,11 +1222,37 @@ private:
             return colour(0, 0, 0);
         }
 
-        // if ray hits nothing, return background colour
-        if (!world.hit(r, interval(0.001, infinity), rec)) {
+        rays += 1;
+
+        // if ray hits nothing, return background colour. scattered rays start just off the surface
+        // they leave, see hit_record::spawn_origin, so they are traced from 0
+        if (!world.hit(r, interval(0, infinity), rec)) {
+            return background;
+        }
+
+        return shade(r, rec, depth, world, rays, first_hit);
+    }
+
+    colour primary_colour(const ray_packet& packet, int lane, const hittable& world, uint64_t& rays, primary_hit* first_hit) const {
+        // ray_colour for a camera ray whose hit the packet already found
+        if (max_depth < 0) {
+            return colour(0, 0, 0);
+        }
+
+        rays += 1;
+
+        if (!packet.hit(lane)) {
             return background;
         }
 
+        return shade(packet.rays[lane], packet.recs[lane], max_depth, world, rays, first_hit);
+    }
+
+    colour shade(const ray& r, const hit_record& rec, int depth, const hittable& world, uint64_t& rays, primary_hit* first_hit) const {
+        if (first_hit != nullptr) {
+            *first_hit = primary_hit{ rec.p, rec.normal, true };
+        }
+
         ray scattered;
         colour attenuation;
         colour colour_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
@@ -198,35 +1261,44 @@ private:
             return colour_from_emission;
         }
 
-        colour colour_from_scatter = attenuation * ray_colour(scattered, depth-1, world);
+        STAT_INC(bounce_rays);
+        colour colour_from_scatter = attenuation * ray_colour(scattered, depth-1, world, rays);
 
         return colour_from_emission + colour_from_scatter;
     }
 
-    ray get_ray(int i, int j) const {
+    ray get_ray(int i, int j, int sample) const {
         // get randomly sampled camera ray for pixel at location i,j
-        // originate from camera defocus disk
+        // originate from camera defocus disk. the random numbers are a hash of the pixel and
+        // sample, so the rays of a packet can all be made before any of them is shaded
+
+        random_sequence rng(hash_combine(hash_combine(sample_key, pixel_index(i, j)), sample));
 
         auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
-        auto pixel_sample = pixel_center + pixel_sample_square();
+        auto pixel_sample = pixel_center + pixel_sample_square(rng);
 
-        auto ray_origin = defocus_angle <= 0 ? center : defocus_disk_sample();
+        auto ray_origin = defocus_angle <= 0 ? center : defocus_disk_sample(rng);
         auto ray_direction = pixel_sample - ray_origin;
-        auto ray_time = random_double();
+        auto ray_time = rng.next_double();
 
         return ray(ray_origin, ray_direction, ray_time);
     }
 
-    point3 defocus_disk_sample() const {
+    point3 defocus_disk_sample(random_sequence& rng) const {
         // random point within defocus disk
-        auto p = random_in_unit_disk();
-        return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
+        while (true) {
+            auto px = 2 * rng.next_double() - 1;
+            auto py = 2 * rng.next_double() - 1;
+            if (px * px + py * py < 1) {
+                return center + (px * defocus_disk_u) + (py * defocus_disk_v);
+            }
+        }
     }
 
-    vec3 pixel_sample_square() const {
+    vec3 pixel_sample_square(random_sequence& rng) const {
         // return random point in square surrounding pixel at origin
-        auto px = -0.5 * random_double();
-        auto py = -0.5 * random_double();
+        auto px = -0.5 * rng.next_double();
+        auto py = -0.5 * rng.next_double();
         return (px * pixel_delta_u) + (py * pixel_delta_v);
     }
 };
@@ -0,0 +1,177 @@
+#include "checkpoint.h"
+#include "timing.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/color.h>
+
+namespace {
+    // file layout (native endianness):
+    //   char[8] magic, uint32 version, int32 width, int32 height,
+    //   uint64 scene hash, uint64 seed, uint64 sample index,
+    //   float[width * height * 3] sums, uint32[width * height] counts
+    const char magic[8] = { 'A', 'C', 'E', 'C', 'K', 'P', 'T', '\0' };
+    const uint32_t version = 1;
+
+    template<typename T>
+    void write_value(std::ofstream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    bool read_value(std::ifstream& in, T& value) {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+}
+
+bool write_checkpoint(const std::string& filename, const checkpoint& ckpt) {
+    // write to a temporary file first so a crash mid-write never corrupts the previous checkpoint
+    auto tmp_filename = filename + ".tmp";
+
+    {
+        std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            spdlog::error("Failed to open checkpoint file: {}", tmp_filename);
+            return false;
+        }
+
+        out.write(magic, sizeof(magic));
+        write_value(out, version);
+        write_value(out, static_cast<int32_t>(ckpt.state.width));
+        write_value(out, static_cast<int32_t>(ckpt.state.height));
+        write_value(out, ckpt.header.scene_hash);
+        write_value(out, ckpt.header.seed);
+        write_value(out, ckpt.header.sample_index);
+        out.write(reinterpret_cast<const char*>(ckpt.state.sums.data()), ckpt.state.sums.size() * sizeof(float));
+        out.write(reinterpret_cast<const char*>(ckpt.state.counts.data()), ckpt.state.counts.size() * sizeof(uint32_t));
+
+        if (!out) {
+            spdlog::error("Failed to write checkpoint file: {}", tmp_filename);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp_filename, filename, ec);
+    if (ec) {
+        spdlog::error("Failed to move checkpoint into place: {}", ec.message());
+        return false;
+    }
+
+    return true;
+}
+
+bool read_checkpoint(const std::string& filename, checkpoint& ckpt) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        spdlog::error("Failed to open checkpoint file: {}", filename);
+        return false;
+    }
+
+    char file_magic[8];
+    uint32_t file_version;
+    int32_t width;
+    int32_t height;
+
+    if (!in.read(file_magic, sizeof(file_magic)) || std::memcmp(file_magic, magic, sizeof(magic)) != 0) {
+        spdlog::error("Not a checkpoint file: {}", filename);
+        return false;
+    }
+
+    if (!read_value(in, file_version) || file_version != version) {
+        spdlog::error("Unsupported checkpoint version: {}", file_version);
+        return false;
+    }
+
+    if (!read_value(in, width) || !read_value(in, height) || width <= 0 || height <= 0 ||
+        !read_value(in, ckpt.header.scene_hash) ||
+        !read_value(in, ckpt.header.seed) ||
+        !read_value(in, ckpt.header.sample_index)) {
+        spdlog::error("Corrupt checkpoint header: {}", filename);
+        return false;
+    }
+
+    auto num_pixels = static_cast<size_t>(width) * height;
+    ckpt.state.width = width;
+    ckpt.state.height = height;
+    ckpt.state.sums.resize(num_pixels * 3);
+    ckpt.state.counts.resize(num_pixels);
+
+    in.read(reinterpret_cast<char*>(ckpt.state.sums.data()), ckpt.state.sums.size() * sizeof(float));
+    in.read(reinterpret_cast<char*>(ckpt.state.counts.data()), ckpt.state.counts.size() * sizeof(uint32_t));
+    if (!in) {
+        spdlog::error("Truncated checkpoint file: {}", filename);
+        return false;
+    }
+
+    return true;
+}
+
+checkpoint_writer::checkpoint_writer(std::string filename, double interval_seconds)
+    : filename(std::move(filename)), interval(interval_seconds)
+{}
+
+checkpoint_writer::~checkpoint_writer() {
+    stop();
+}
+
+void checkpoint_writer::start(const accumulator& _accum, uint64_t scene_hash, uint64_t seed) {
+    stop();
+
+    accum = &_accum;
+    header.scene_hash = scene_hash;
+    header.seed = seed;
+    stopping = false;
+
+    thread = std::thread(&checkpoint_writer::run, this);
+}
+
+void checkpoint_writer::stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    thread.join();
+
+    save();
+}
+
+void checkpoint_writer::run() {
+    trace::set_thread_name("checkpoint writer");
+
+    auto period = std::chrono::duration<double>(interval);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!cv.wait_for(lock, period, [this] { return stopping; })) {
+        lock.unlock();
+        save();
+        lock.lock();
+    }
+}
+
+void checkpoint_writer::save() {
+    using namespace fmt;
+
+    timer time;
+
+    trace_zone zone("checkpoint write", "io");
+
+    checkpoint ckpt;
+    ckpt.header = header;
+    ckpt.state = accum->snapshot();
+    ckpt.header.sample_index = ckpt.state.total_samples();
+
+    if (write_checkpoint(filename, ckpt)) {
+        auto diff = time.duration<timer::milliseconds>();
+        spdlog::debug("Wrote checkpoint {} ({} samples) in {}", filename, ckpt.header.sample_index, format(fg(color::aqua), "{:.2f}ms", diff));
+    }
+}
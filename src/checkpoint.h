@@ -0,0 +1,54 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "accumulator.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct checkpoint_header {
+    uint64_t scene_hash = 0;
+    uint64_t seed = 0;
+    uint64_t sample_index = 0; // total samples accumulated over all pixels
+};
+
+struct checkpoint {
+    checkpoint_header header;
+    accumulator_snapshot state;
+};
+
+bool write_checkpoint(const std::string& filename, const checkpoint& ckpt);
+bool read_checkpoint(const std::string& filename, checkpoint& ckpt);
+
+class checkpoint_writer {
+public:
+    // periodically snapshots an accumulator and writes it out on a background thread so that
+    // the render workers are never blocked on disk io
+    checkpoint_writer(std::string filename, double interval_seconds);
+    ~checkpoint_writer();
+
+    void start(const accumulator& accum, uint64_t scene_hash, uint64_t seed);
+
+    // stops the background thread, writing one final checkpoint
+    void stop();
+
+private:
+    std::string filename;
+    double interval;
+
+    const accumulator* accum = nullptr;
+    checkpoint_header header;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void run();
+    void save();
+};
+
+#endif//__CHECKPOINT_H__
@@ -1,6 +1,9 @@
 #include "colour.h"
 #include "interval.h"
 #include "rtweekend.h"
+#include "simd.h"
+
+#include <algorithm>
 
 void write_colour(pixel &out, colour pixel_colour, int samples_per_pixel) {
     auto r = pixel_colour.x();
@@ -23,3 +26,47 @@ void write_colour(pixel &out, colour pixel_colour, int samples_per_pixel) {
     out.b = static_cast<int>(256 * intensity.clamp(b));
     out.a = 255;
 }
+
+void write_colours(pixel* out, const float* sums, const uint32_t* counts, size_t n) {
+    // in float rather than double, so four lanes on every target. A channel can come out one
+    // step away from write_colour's when it lands within float rounding of a step boundary
+    const auto zero = float4::broadcast(0.0f);
+    const auto one = float4::broadcast(1.0f);
+    const auto hi = float4::broadcast(0.99999f);
+    const auto full = float4::broadcast(256.0f);
+
+    for (size_t first = 0; first < n; first += 4) {
+        auto lanes = std::min<size_t>(4, n - first);
+
+        // one pixel per lane, gathered into a lane per channel
+        alignas(16) float r[4] = {}, g[4] = {}, b[4] = {}, count[4] = { 1, 1, 1, 1 };
+        for (size_t i = 0; i < lanes; i += 1) {
+            count[i] = static_cast<float>(std::max<uint32_t>(counts[first + i], 1));
+            r[i] = sums[(first + i) * 3 + 0];
+            g[i] = sums[(first + i) * 3 + 1];
+            b[i] = sums[(first + i) * 3 + 2];
+        }
+
+        auto scale = one / float4::load(count);
+        auto to_byte = [&](const float* channel, float* result) {
+            auto c = sqrt(float4::load(channel) * scale);
+            (full * max(min(c, hi), zero)).store(result);
+        };
+
+        alignas(16) float rr[4], gg[4], bb[4];
+        to_byte(r, rr);
+        to_byte(g, gg);
+        to_byte(b, bb);
+
+        for (size_t i = 0; i < lanes; i += 1) {
+            if (counts[first + i] == 0) {
+                continue;
+            }
+            auto& px = out[first + i];
+            px.r = static_cast<uint8_t>(rr[i]);
+            px.g = static_cast<uint8_t>(gg[i]);
+            px.b = static_cast<uint8_t>(bb[i]);
+            px.a = 255;
+        }
+    }
+}
@@ -4,6 +4,9 @@
 #include "vec3.h"
 #include "pixel.h"
 
+#include <cstddef>
+#include <cstdint>
+
 using colour = vec3;
 
 inline colour lerp(double a, const colour& start, const colour& end) {
@@ -16,4 +19,8 @@ inline double linear_to_gamma(double linear_component) {
 
 void write_colour(pixel &out, colour pixel_colour, int samples_per_pixel);
 
+// Converts n pixels four at a time, with the same results as write_colour. sums holds the
+// accumulated rgb triples and counts the samples in each, pixels with no samples are skipped.
+void write_colours(pixel* out, const float* sums, const uint32_t* counts, size_t n);
+
 #endif//__COLOUR_H__
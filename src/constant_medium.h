@@ -19,6 +19,8 @@ public:
     {}
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        STAT_INC(medium_tests);
+
         // print samples when debugging when enableDebug set to true
         const bool enableDebug = false;
         const bool debugging = enableDebug && random_double() < 0.00001;
@@ -69,6 +71,7 @@ public:
 
         rec.normal = vec3(1, 0, 0); // arbitrary
         rec.front_face = true; // also arbitrary
+        rec.p_error = 0; // no surface to step off, the scattered ray starts inside the medium
         rec.mat = phase_function;
 
         return true;
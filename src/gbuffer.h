@@ -0,0 +1,71 @@
+#ifndef __GBUFFER_H__
+#define __GBUFFER_H__
+
+#include "vec3.h"
+
+#include <cstdint>
+#include <vector>
+
+// where the first camera ray through a pixel hit the scene
+struct primary_hit {
+    point3 p;
+    vec3 normal;
+    bool hit = false;
+};
+
+// Per pixel position and normal of the primary hit, kept in floats. Used to reproject
+// accumulated samples into a new view.
+class gbuffer {
+public:
+    int width() const { return w; }
+    int height() const { return h; }
+
+    void resize(int _w, int _h) {
+        w = _w;
+        h = _h;
+        positions.assign(static_cast<size_t>(w) * h * 3, 0.0f);
+        normals.assign(static_cast<size_t>(w) * h * 3, 0.0f);
+        valid.assign(static_cast<size_t>(w) * h, 0);
+    }
+
+    void set(int x, int y, const primary_hit& hit) {
+        // each pixel is only written by the task that owns it
+        auto i = index(x, y);
+        valid[i] = hit.hit;
+        if (!hit.hit) {
+            return;
+        }
+
+        for (int c = 0; c < 3; c += 1) {
+            positions[i * 3 + c] = static_cast<float>(hit.p[c]);
+            normals[i * 3 + c] = static_cast<float>(hit.normal[c]);
+        }
+    }
+
+    bool has_hit(int x, int y) const {
+        return valid[index(x, y)] != 0;
+    }
+
+    point3 position_at(int x, int y) const {
+        auto i = index(x, y) * 3;
+        return point3(positions[i], positions[i + 1], positions[i + 2]);
+    }
+
+    vec3 normal_at(int x, int y) const {
+        auto i = index(x, y) * 3;
+        return vec3(normals[i], normals[i + 1], normals[i + 2]);
+    }
+
+private:
+    int w = 0;
+    int h = 0;
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<uint8_t> valid;
+
+    inline size_t index(int x, int y) const {
+        return static_cast<size_t>(y) * w + x;
+    }
+};
+
+#endif//__GBUFFER_H__
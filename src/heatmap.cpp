@@ -0,0 +1,105 @@
+#include "heatmap.h"
+#include "interval.h"
+
+#include <algorithm>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/color.h>
+
+bool parse_render_mode(const std::string& name, render_mode& mode) {
+    if (name == "beauty") {
+        mode = render_mode::beauty;
+    } else if (name == "nodes") {
+        mode = render_mode::heatmap_nodes;
+    } else if (name == "primitives") {
+        mode = render_mode::heatmap_primitives;
+    } else if (name == "cycles") {
+        mode = render_mode::heatmap_cycles;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* render_mode_name(render_mode mode) {
+    switch (mode) {
+        case render_mode::beauty: return "beauty";
+        case render_mode::heatmap_nodes: return "bvh nodes visited";
+        case render_mode::heatmap_primitives: return "primitives tested";
+        case render_mode::heatmap_cycles: return "cycles";
+    }
+    return "unknown";
+}
+
+heatmap_summary summarize_costs(const std::vector<float>& costs, int buckets) {
+    heatmap_summary summary;
+    if (costs.empty()) {
+        return summary;
+    }
+
+    auto sorted = costs;
+    std::sort(sorted.begin(), sorted.end());
+
+    auto percentile = [&](double p) {
+        return static_cast<double>(sorted[static_cast<size_t>(p * (sorted.size() - 1))]);
+    };
+
+    double total = 0;
+    for (auto cost : sorted) {
+        total += cost;
+    }
+
+    summary.min = sorted.front();
+    summary.max = sorted.back();
+    summary.mean = total / sorted.size();
+    summary.p50 = percentile(0.50);
+    summary.p90 = percentile(0.90);
+    summary.p99 = percentile(0.99);
+
+    // cap at the 99th percentile so a few very hot pixels don't squash everything into the first bucket
+    summary.histogram_max = summary.p99 > 0 ? summary.p99 : summary.max;
+    summary.histogram.assign(buckets, 0);
+    for (auto cost : sorted) {
+        auto bucket = summary.histogram_max > 0 ? static_cast<int>(buckets * cost / summary.histogram_max) : 0;
+        summary.histogram[std::min(bucket, buckets - 1)] += 1;
+    }
+
+    return summary;
+}
+
+void log_heatmap_summary(render_mode mode, const heatmap_summary& summary) {
+    using namespace fmt;
+
+    spdlog::info("Cost per sample ({}):", render_mode_name(mode));
+    spdlog::info("  min {:.1f}, mean {:.1f}, median {:.1f}, p90 {:.1f}, p99 {:.1f}, max {:.1f}", summary.min, summary.mean, summary.p50, summary.p90, summary.p99, summary.max);
+    if (summary.p50 > 0) {
+        spdlog::info("  hottest pixel is {} the median", format(fg(color::aqua), "{:.1f}x", summary.max / summary.p50));
+    }
+
+    size_t largest = 1;
+    for (auto count : summary.histogram) {
+        largest = std::max(largest, count);
+    }
+
+    auto buckets = summary.histogram.size();
+    for (size_t i = 0; i < buckets; i += 1) {
+        auto lo = summary.histogram_max * i / buckets;
+        auto hi = i + 1 == buckets ? summary.max : summary.histogram_max * (i + 1) / buckets;
+        auto bar = std::string(40 * summary.histogram[i] / largest, '#');
+        spdlog::info("  {:>10.1f} - {:<10.1f} {:>8} {}", lo, hi, summary.histogram[i], bar);
+    }
+}
+
+colour heatmap_colour(double t) {
+    static const colour stops[] = {
+        colour(0.0, 0.0, 0.2),
+        colour(0.0, 0.4, 1.0),
+        colour(0.0, 0.9, 0.3),
+        colour(1.0, 0.9, 0.0),
+        colour(1.0, 0.0, 0.0),
+    };
+    const int num_stops = sizeof(stops) / sizeof(stops[0]);
+
+    t = interval(0, 1).clamp(t) * (num_stops - 1);
+    auto i = std::min(static_cast<int>(t), num_stops - 2);
+    return lerp(t - i, stops[i], stops[i + 1]);
+}
@@ -0,0 +1,36 @@
+#ifndef __HEATMAP_H__
+#define __HEATMAP_H__
+
+#include "colour.h"
+
+#include <string>
+#include <vector>
+
+enum class render_mode {
+    beauty,
+    heatmap_nodes, // bvh nodes visited per sample
+    heatmap_primitives, // primitive intersection tests per sample
+    heatmap_cycles, // cpu cycles per sample
+};
+
+bool parse_render_mode(const std::string& name, render_mode& mode);
+const char* render_mode_name(render_mode mode);
+
+struct heatmap_summary {
+    double min = 0;
+    double max = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double histogram_max = 0;
+    std::vector<size_t> histogram; // evenly spaced buckets over [0, histogram_max], the last one also holds the outliers
+};
+
+heatmap_summary summarize_costs(const std::vector<float>& costs, int buckets = 10);
+void log_heatmap_summary(render_mode mode, const heatmap_summary& summary);
+
+// false colour ramp from dark blue (cheap) through green and yellow to red (expensive)
+colour heatmap_colour(double t);
+
+#endif//__HEATMAP_H__
@@ -5,11 +5,14 @@
 #include "interval.h"
 #include "aabb.h"
 
+#include <cstdint>
 #include <memory>
 
 struct draw_options;
+struct ray_packet;
 
 class material;
+class ray_bounds;
 
 class hit_record {
 public:
@@ -20,6 +23,7 @@ public:
     double u;
     double v;
     bool front_face;
+    double p_error = 0; // bound on how far p may be from the surface on any axis
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         // Sets the hit record normal vector
@@ -28,6 +32,15 @@ public:
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    inline point3 spawn_origin(const vec3& direction) const {
+        // Origin for a ray leaving the surface in direction. p is pushed off the surface, to the
+        // side direction points to, by more than its error, so the new ray can't hit the
+        // surface it starts on and can be traced from t = 0 rather than a fixed epsilon
+        auto distance = 2 * p_error * (fabs(normal.x()) + fabs(normal.y()) + fabs(normal.z()));
+        auto offset = distance * normal;
+        return dot(direction, normal) < 0 ? p - offset : p + offset;
+    }
 };
 
 class hittable {
@@ -38,6 +51,25 @@ public:
     virtual aabb bounding_box() const = 0;
 
     virtual void draw(const draw_options& options) const = 0;
+
+    // Animation, see animation.h. Objects that move between frames work out their next state in
+    // prepare_frame while the current frame is still being traced, returning their bounds for
+    // it, and only switch over to it in commit_frame once tracing has finished.
+    virtual bool animated() const { return false; }
+    virtual aabb prepare_frame(double time) { return bounding_box(); }
+    virtual void commit_frame() {}
+
+    // Spatial splits, see quantized_bvh. An object that may be referenced from more than one
+    // leaf returns true and the bounds of its part inside region, empty if none of it is. The
+    // default keeps the object whole, which anything that isn't hit the same way every time it
+    // is tested, like a volume, has to.
+    virtual bool clip_box(const aabb& region, aabb& clipped) const { return false; }
+
+    // Packet tracing, see packet.h. hit_packet finds the closest hit of every active lane of the
+    // packet, by default by tracing its rays one at a time. packet_entry returns the deepest
+    // object that every ray within bounds has to start from, or nullptr if none can hit anything.
+    virtual void hit_packet(ray_packet& packet, uint64_t active) const;
+    virtual const hittable* packet_entry(const ray_bounds& bounds) const { return this; }
 };
 
 class translate : public hittable {
@@ -49,6 +81,8 @@ public:
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        STAT_INC(instance_tests);
+
         // move ray backwards by offset
         ray offset_r(r.origin() - offset, r.direction(), r.time());
 
@@ -59,6 +93,7 @@ public:
 
         // moe intersection point forwards by offset
         rec.p += offset;
+        rec.p_error += rounding_error(1) * max_abs_component(rec.p);
         return true;
     }
 
@@ -106,6 +141,8 @@ public:
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        STAT_INC(instance_tests);
+
         // convert from world to object space
         auto origin = r.origin();
         auto direction = r.direction();
@@ -133,6 +170,7 @@ public:
 
         rec.p = p;
         rec.normal = normal;
+        rec.p_error = rec.p_error * (fabs(cos_theta) + fabs(sin_theta)) + rounding_error(3) * max_abs_component(p);
 
         return true;
     }
@@ -15,11 +15,23 @@ hittable_list::hittable_list(shared_ptr<hittable> object) {
 
 void hittable_list::clear() {
     objects.clear();
+    bbox = aabb();
+    dynamic = false;
 }
 
 void hittable_list::add(shared_ptr<hittable> object) {
     objects.push_back(object);
     bbox = aabb(bbox, object->bounding_box());
+    dynamic = dynamic || object->animated();
+}
+
+void hittable_list::refit() {
+    bbox = aabb();
+    dynamic = false;
+    for (const auto& object : objects) {
+        bbox = aabb(bbox, object->bounding_box());
+        dynamic = dynamic || object->animated();
+    }
 }
 
 bool hittable_list::hit(const ray& r, interval ray_t, hit_record& rec) const {
@@ -37,3 +49,26 @@ bool hittable_list::hit(const ray& r, interval ray_t, hit_record& rec) const {
 
     return hit_anything;
 }
+
+aabb hittable_list::prepare_frame(double time) {
+    if (!dynamic) {
+        return bbox;
+    }
+
+    next_bbox = aabb();
+    for (const auto& object : objects) {
+        next_bbox = aabb(next_bbox, object->prepare_frame(time));
+    }
+    return next_bbox;
+}
+
+void hittable_list::commit_frame() {
+    if (!dynamic) {
+        return;
+    }
+
+    for (const auto& object : objects) {
+        object->commit_frame();
+    }
+    bbox = next_bbox;
+}
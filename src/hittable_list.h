@@ -16,13 +16,25 @@ public:
 
     void clear();
     void add(std::shared_ptr<hittable> object);
+
+    // works out the bounds again, after objects already in the list were edited
+    void refit();
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
     inline aabb bounding_box() const override { return bbox; }
 
+    void hit_packet(ray_packet& packet, uint64_t active) const override;
+    const hittable* packet_entry(const ray_bounds& bounds) const override;
+
     void draw(const draw_options& options) const override;
 
+    bool animated() const override { return dynamic; }
+    aabb prepare_frame(double time) override;
+    void commit_frame() override;
+
 private:
     aabb bbox;
+    aabb next_bbox;
+    bool dynamic = false; // holds at least one animated object
 };
 
 #endif//__HITTABLE_LIST_H__
@@ -0,0 +1,205 @@
+#include "image_stream.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/core.h>
+
+namespace {
+    const std::array<uint32_t, 256> crc_table = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t n = 0; n < 256; n += 1) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k += 1) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    uint32_t crc32(const char* type, const std::string& data) {
+        uint32_t c = 0xffffffffu;
+        auto update = [&](unsigned char byte) {
+            c = crc_table[(c ^ byte) & 0xff] ^ (c >> 8);
+        };
+        for (int i = 0; i < 4; i += 1) {
+            update(static_cast<unsigned char>(type[i]));
+        }
+        for (auto byte : data) {
+            update(static_cast<unsigned char>(byte));
+        }
+        return c ^ 0xffffffffu;
+    }
+
+    void put_u32(std::string& out, uint32_t value) {
+        out += static_cast<char>((value >> 24) & 0xff);
+        out += static_cast<char>((value >> 16) & 0xff);
+        out += static_cast<char>((value >> 8) & 0xff);
+        out += static_cast<char>(value & 0xff);
+    }
+
+    void put_u16_le(std::string& out, uint16_t value) {
+        out += static_cast<char>(value & 0xff);
+        out += static_cast<char>((value >> 8) & 0xff);
+    }
+}
+
+bool ppm_stream::open(const std::string& filename, int width, int height) {
+    w = width;
+    h = height;
+    out.open(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    out << fmt::format("P6\n{} {}\n255\n", width, height);
+    return static_cast<bool>(out);
+}
+
+bool ppm_stream::write_rows(const pixel* rows, int num_rows) {
+    std::string buffer;
+    buffer.reserve(static_cast<size_t>(w) * num_rows * 3);
+    for (size_t i = 0; i < static_cast<size_t>(w) * num_rows; i += 1) {
+        buffer += static_cast<char>(rows[i].r);
+        buffer += static_cast<char>(rows[i].g);
+        buffer += static_cast<char>(rows[i].b);
+    }
+
+    out.write(buffer.data(), buffer.size());
+    written += num_rows;
+    return static_cast<bool>(out);
+}
+
+bool ppm_stream::finish() {
+    out.close();
+    return written == h && !out.fail();
+}
+
+bool png_stream::open(const std::string& filename, int width, int height) {
+    w = width;
+    h = height;
+    out.open(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    const char signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+    out.write(signature, sizeof(signature));
+
+    // 8 bit rgb, default compression and filter methods, no interlacing
+    std::string ihdr;
+    put_u32(ihdr, width);
+    put_u32(ihdr, height);
+    ihdr += '\x08';
+    ihdr += '\x02';
+    ihdr += '\x00';
+    ihdr += '\x00';
+    ihdr += '\x00';
+    write_chunk("IHDR", ihdr);
+
+    return static_cast<bool>(out);
+}
+
+bool png_stream::write_rows(const pixel* rows, int num_rows) {
+    // every scanline starts with its filter type, 0 is none
+    std::string raw;
+    raw.reserve(static_cast<size_t>(w * 3 + 1) * num_rows);
+    for (int y = 0; y < num_rows; y += 1) {
+        raw += '\x00';
+        for (int x = 0; x < w; x += 1) {
+            const auto& px = rows[static_cast<size_t>(y) * w + x];
+            raw += static_cast<char>(px.r);
+            raw += static_cast<char>(px.g);
+            raw += static_cast<char>(px.b);
+        }
+    }
+
+    std::string idat;
+    if (written == 0) {
+        // zlib header, deflate with a 32k window and no preset dictionary
+        idat += '\x78';
+        idat += '\x01';
+    }
+    append_stored_blocks(idat, raw, false);
+    write_chunk("IDAT", idat);
+
+    written += num_rows;
+    return static_cast<bool>(out);
+}
+
+bool png_stream::finish() {
+    // an empty final block closes the deflate stream, followed by the adler32 of the raw data
+    std::string idat;
+    if (written == 0) {
+        idat += '\x78';
+        idat += '\x01';
+    }
+    append_stored_blocks(idat, std::string(), true);
+    put_u32(idat, (adler_b << 16) | adler_a);
+    write_chunk("IDAT", idat);
+    write_chunk("IEND", std::string());
+
+    out.close();
+    return written == h && !out.fail();
+}
+
+void png_stream::write_chunk(const char* type, const std::string& data) {
+    std::string header;
+    put_u32(header, static_cast<uint32_t>(data.size()));
+    header.append(type, 4);
+
+    std::string footer;
+    put_u32(footer, crc32(type, data));
+
+    out.write(header.data(), header.size());
+    out.write(data.data(), data.size());
+    out.write(footer.data(), footer.size());
+}
+
+void png_stream::append_stored_blocks(std::string& idat, const std::string& raw, bool final) {
+    const size_t max_block = 65535;
+
+    size_t offset = 0;
+    do {
+        auto len = std::min(max_block, raw.size() - offset);
+        bool last = final && offset + len == raw.size();
+
+        idat += last ? '\x01' : '\x00';
+        put_u16_le(idat, static_cast<uint16_t>(len));
+        put_u16_le(idat, static_cast<uint16_t>(~len));
+        idat.append(raw, offset, len);
+
+        for (size_t i = offset; i < offset + len; i += 1) {
+            adler_a = (adler_a + static_cast<unsigned char>(raw[i])) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+
+        offset += len;
+    } while (offset < raw.size());
+}
+
+std::unique_ptr<image_stream> open_image_stream(const std::string& filename, int width, int height) {
+    auto ext = std::filesystem::path(filename).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    if (ext == ".ppm") {
+        auto stream = std::make_unique<ppm_stream>();
+        if (stream->open(filename, width, height)) {
+            return stream;
+        }
+    } else if (ext == ".png") {
+        auto stream = std::make_unique<png_stream>();
+        if (stream->open(filename, width, height)) {
+            return stream;
+        }
+    } else {
+        spdlog::error("Unsupported output format \"{}\", use .ppm or .png", ext);
+        return nullptr;
+    }
+
+    spdlog::error("Failed to open output file: {}", filename);
+    return nullptr;
+}
@@ -0,0 +1,59 @@
+#ifndef __IMAGE_STREAM_H__
+#define __IMAGE_STREAM_H__
+
+#include "pixel.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+// Writes an image a band of rows at a time, top to bottom, so the whole frame never has to be
+// held in memory. Alpha is dropped.
+class image_stream {
+public:
+    virtual ~image_stream() = default;
+
+    virtual bool write_rows(const pixel* rows, int num_rows) = 0;
+    virtual bool finish() = 0;
+
+    int width() const { return w; }
+    int height() const { return h; }
+    int rows_written() const { return written; }
+
+protected:
+    int w = 0;
+    int h = 0;
+    int written = 0;
+};
+
+// binary ppm (P6)
+class ppm_stream : public image_stream {
+public:
+    bool open(const std::string& filename, int width, int height);
+    bool write_rows(const pixel* rows, int num_rows) override;
+    bool finish() override;
+
+private:
+    std::ofstream out;
+};
+
+// png with stored (uncompressed) deflate blocks, one IDAT chunk per band
+class png_stream : public image_stream {
+public:
+    bool open(const std::string& filename, int width, int height);
+    bool write_rows(const pixel* rows, int num_rows) override;
+    bool finish() override;
+
+private:
+    std::ofstream out;
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+
+    void write_chunk(const char* type, const std::string& data);
+    void append_stored_blocks(std::string& idat, const std::string& raw, bool final);
+};
+
+// picks the format from the extension, .ppm or .png
+std::unique_ptr<image_stream> open_image_stream(const std::string& filename, int width, int height);
+
+#endif//__IMAGE_STREAM_H__
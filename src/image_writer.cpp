@@ -0,0 +1,272 @@
+#include "image_writer.h"
+#include "timing.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/color.h>
+#include <stb_image_write.h>
+
+namespace {
+    void put_u32_be(std::vector<unsigned char>& out, uint32_t value) {
+        out.push_back((value >> 24) & 0xff);
+        out.push_back((value >> 16) & 0xff);
+        out.push_back((value >> 8) & 0xff);
+        out.push_back(value & 0xff);
+    }
+
+    void append(std::vector<unsigned char>& out, const std::string& str) {
+        out.insert(out.end(), str.begin(), str.end());
+    }
+
+    std::vector<unsigned char> encode_png(const image_buffer& image) {
+        std::vector<unsigned char> out;
+        auto write = [](void* context, void* data, int size) {
+            auto* bytes = static_cast<unsigned char*>(data);
+            static_cast<std::vector<unsigned char>*>(context)->insert(static_cast<std::vector<unsigned char>*>(context)->end(), bytes, bytes + size);
+        };
+
+        const int channels = 4;
+        stbi_write_png_to_func(write, &out, image.width, image.height, channels, image.pixels.data(), channels * image.width);
+        return out;
+    }
+
+    std::vector<unsigned char> encode_qoi(const image_buffer& image) {
+        // https://qoiformat.org/qoi-specification.pdf
+        const unsigned char op_index = 0x00;
+        const unsigned char op_diff = 0x40;
+        const unsigned char op_luma = 0x80;
+        const unsigned char op_run = 0xc0;
+        const unsigned char op_rgb = 0xfe;
+        const unsigned char op_rgba = 0xff;
+
+        std::vector<unsigned char> out;
+        out.reserve(14 + image.pixels.size() * 2);
+
+        append(out, "qoif");
+        put_u32_be(out, image.width);
+        put_u32_be(out, image.height);
+        out.push_back(4); // rgba
+        out.push_back(0); // srgb with linear alpha
+
+        pixel index[64] = {};
+        pixel prev{ 0, 0, 0, 255 };
+        int run = 0;
+
+        auto same = [](const pixel& a, const pixel& b) {
+            return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+        };
+
+        for (size_t i = 0; i < image.pixels.size(); i += 1) {
+            const auto& px = image.pixels[i];
+
+            if (same(px, prev)) {
+                run += 1;
+                if (run == 62 || i + 1 == image.pixels.size()) {
+                    out.push_back(op_run | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                out.push_back(op_run | (run - 1));
+                run = 0;
+            }
+
+            auto hash = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+            if (same(index[hash], px)) {
+                out.push_back(op_index | hash);
+            } else {
+                index[hash] = px;
+
+                if (px.a == prev.a) {
+                    int8_t vr = static_cast<int8_t>(px.r - prev.r);
+                    int8_t vg = static_cast<int8_t>(px.g - prev.g);
+                    int8_t vb = static_cast<int8_t>(px.b - prev.b);
+                    int8_t vg_r = static_cast<int8_t>(vr - vg);
+                    int8_t vg_b = static_cast<int8_t>(vb - vg);
+
+                    if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1) {
+                        out.push_back(op_diff | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+                    } else if (vg >= -32 && vg <= 31 && vg_r >= -8 && vg_r <= 7 && vg_b >= -8 && vg_b <= 7) {
+                        out.push_back(op_luma | (vg + 32));
+                        out.push_back(((vg_r + 8) << 4) | (vg_b + 8));
+                    } else {
+                        out.push_back(op_rgb);
+                        out.push_back(px.r);
+                        out.push_back(px.g);
+                        out.push_back(px.b);
+                    }
+                } else {
+                    out.push_back(op_rgba);
+                    out.push_back(px.r);
+                    out.push_back(px.g);
+                    out.push_back(px.b);
+                    out.push_back(px.a);
+                }
+            }
+
+            prev = px;
+        }
+
+        const unsigned char end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+        out.insert(out.end(), end_marker, end_marker + sizeof(end_marker));
+        return out;
+    }
+
+    std::vector<unsigned char> encode_ppm(const image_buffer& image) {
+        std::vector<unsigned char> out;
+        append(out, fmt::format("P6\n{} {}\n255\n", image.width, image.height));
+        out.reserve(out.size() + image.pixels.size() * 3);
+        for (const auto& px : image.pixels) {
+            out.push_back(px.r);
+            out.push_back(px.g);
+            out.push_back(px.b);
+        }
+        return out;
+    }
+
+    std::vector<unsigned char> encode_pfm(const image_buffer& image) {
+        // a negative scale marks little endian data, rows go from the bottom up
+        std::vector<unsigned char> out;
+        append(out, fmt::format("PF\n{} {}\n-1.0\n", image.width, image.height));
+
+        auto header_size = out.size();
+        auto row_floats = static_cast<size_t>(image.width) * 3;
+        out.resize(header_size + row_floats * image.height * sizeof(float));
+
+        for (int y = 0; y < image.height; y += 1) {
+            auto* src = &image.hdr[static_cast<size_t>(image.height - 1 - y) * row_floats];
+            auto* dst = &out[header_size + static_cast<size_t>(y) * row_floats * sizeof(float)];
+            for (size_t i = 0; i < row_floats; i += 1) {
+                uint32_t bits;
+                std::memcpy(&bits, &src[i], sizeof(bits));
+                dst[i * 4 + 0] = bits & 0xff;
+                dst[i * 4 + 1] = (bits >> 8) & 0xff;
+                dst[i * 4 + 2] = (bits >> 16) & 0xff;
+                dst[i * 4 + 3] = (bits >> 24) & 0xff;
+            }
+        }
+        return out;
+    }
+}
+
+bool image_format_from_filename(const std::string& filename, image_format& format) {
+    auto ext = std::filesystem::path(filename).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    if (ext == ".png") {
+        format = image_format::png;
+    } else if (ext == ".qoi") {
+        format = image_format::qoi;
+    } else if (ext == ".ppm") {
+        format = image_format::ppm;
+    } else if (ext == ".pfm") {
+        format = image_format::pfm;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* image_format_name(image_format format) {
+    switch (format) {
+        case image_format::png: return "png";
+        case image_format::qoi: return "qoi";
+        case image_format::ppm: return "ppm";
+        case image_format::pfm: return "pfm";
+    }
+    return "unknown";
+}
+
+std::vector<unsigned char> encode_image(image_format format, const image_buffer& image) {
+    switch (format) {
+        case image_format::png: return encode_png(image);
+        case image_format::qoi: return encode_qoi(image);
+        case image_format::ppm: return encode_ppm(image);
+        case image_format::pfm: return encode_pfm(image);
+    }
+    return {};
+}
+
+bool write_image(const std::string& filename, const image_buffer& image) {
+    using namespace fmt;
+
+    image_format file_format;
+    if (!image_format_from_filename(filename, file_format)) {
+        spdlog::error("Unsupported image format: {}, use .png, .qoi, .ppm or .pfm", filename);
+        return false;
+    }
+
+    if (file_format == image_format::pfm && image.hdr.size() != static_cast<size_t>(image.width) * image.height * 3) {
+        spdlog::error("No float colour data to write to {}", filename);
+        return false;
+    }
+
+    timer time;
+
+    std::vector<unsigned char> data;
+    {
+        trace_zone zone("image encode", "io");
+        zone.arg("format", image_format_name(file_format));
+        data = encode_image(file_format, image);
+    }
+    auto encode_ms = time.duration<timer::milliseconds>();
+
+    {
+        trace_zone zone("file write", "io");
+        zone.arg("file", filename);
+
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!out || data.empty()) {
+            spdlog::error("Failed to write file: {}", filename);
+            return false;
+        }
+    }
+
+    auto diff = time.duration<timer::milliseconds>();
+    spdlog::info("Wrote {} ({} KiB), encode {}, total {}", styled(filename, fg(color::aqua)), data.size() / 1024,
+        format(fg(color::aqua), "{:.2f}ms", encode_ms), format(fg(color::aqua), "{:.2f}ms", diff));
+    return true;
+}
+
+void async_image_writer::submit(std::string filename, image_buffer image) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        in_flight += 1;
+    }
+
+    executor.silent_async([this, filename = std::move(filename), image = std::move(image)]() {
+        auto ok = write_image(filename, image);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = failed || !ok;
+        in_flight -= 1;
+        cv.notify_all();
+    });
+}
+
+bool async_image_writer::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return in_flight == 0; });
+
+    auto ok = !failed;
+    failed = false;
+    return ok;
+}
+
+void async_image_writer::throttle(int max_pending) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this, max_pending] { return in_flight < max_pending; });
+}
+
+int async_image_writer::pending() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return in_flight;
+}
@@ -0,0 +1,68 @@
+#ifndef __IMAGE_WRITER_H__
+#define __IMAGE_WRITER_H__
+
+#include "pixel.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <taskflow/taskflow.hpp>
+
+enum class image_format {
+    png, // deflate compressed, slowest to write
+    qoi, // lossless and several times faster to encode than png
+    ppm, // binary P6, no encoding at all
+    pfm, // 32 bit float linear colour, needs hdr data
+};
+
+// picks the format from the file extension
+bool image_format_from_filename(const std::string& filename, image_format& format);
+const char* image_format_name(image_format format);
+
+struct image_buffer {
+    int width = 0;
+    int height = 0;
+    std::vector<pixel> pixels; // display colours, row major from the top
+    std::vector<float> hdr; // linear rgb triples for float formats, may be empty
+};
+
+std::vector<unsigned char> encode_image(image_format format, const image_buffer& image);
+
+// encodes and writes on the calling thread
+bool write_image(const std::string& filename, const image_buffer& image);
+
+// Encodes and writes images as tasks on the executor, so the caller can carry on rendering.
+// Images are independent, so several can be encoding at once.
+class async_image_writer {
+public:
+    explicit async_image_writer(tf::Executor& executor) : executor(executor) {}
+
+    ~async_image_writer() {
+        wait();
+    }
+
+    async_image_writer(const async_image_writer&) = delete;
+    async_image_writer& operator=(const async_image_writer&) = delete;
+
+    void submit(std::string filename, image_buffer image);
+
+    // blocks until every submitted image is written, returns false if any failed
+    bool wait();
+
+    // blocks until fewer than max_pending images are still being written, so a producer that
+    // outpaces the encoder doesn't queue up every image in memory
+    void throttle(int max_pending);
+
+    int pending() const;
+
+private:
+    tf::Executor& executor;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    int in_flight = 0;
+    bool failed = false;
+};
+
+#endif//__IMAGE_WRITER_H__
@@ -3,17 +3,23 @@
 
 #include "rtweekend.h"
 
-class interval {
+template<typename T>
+class basic_interval {
 public:
-    double min, max;
+    T min, max;
 
-    inline interval(): min(+infinity), max(-infinity) {} // Default interval is empty
+    inline basic_interval(): min(+infinity), max(-infinity) {} // Default interval is empty
 
-    inline interval(double _min, double _max): min(_min), max(_max) {}
+    inline basic_interval(T _min, T _max): min(_min), max(_max) {}
 
-    inline interval(const interval& a, const interval& b)
+    inline basic_interval(const basic_interval& a, const basic_interval& b)
         : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
 
+    // converting between precisions rounds outwards, so the result always covers the original
+    template<typename U>
+    inline basic_interval(const basic_interval<U>& other)
+        : min(round_down<T>(other.min)), max(round_up<T>(other.max)) {}
+
     inline bool contains(double x) const {
         return min <= x && x <= max;
     }
@@ -32,26 +38,34 @@ public:
         return x;
     }
 
-    inline double size() const {
+    inline T size() const {
         return max - min;
     }
 
-    inline interval expand(double delta) const {
+    inline basic_interval expand(double delta) const {
         auto padding = delta / 2;
-        return interval(min - padding, max + padding);
+        return basic_interval<double>(min - padding, max + padding);
     }
 
-    static const interval empty, universe;
+    static const basic_interval empty, universe;
 };
 
-inline const interval interval::empty = interval(+infinity, -infinity);
-inline const interval interval::universe = interval(-infinity, +infinity);
+template<typename T>
+inline const basic_interval<T> basic_interval<T>::empty = basic_interval<T>(+infinity, -infinity);
+
+template<typename T>
+inline const basic_interval<T> basic_interval<T>::universe = basic_interval<T>(-infinity, +infinity);
+
+// ray parameters and everything else computed in double
+using interval = basic_interval<double>;
 
-inline interval operator+(const interval& ival, double displacement) {
+template<typename T>
+inline basic_interval<T> operator+(const basic_interval<T>& ival, double displacement) {
     return interval(ival.min + displacement, ival.max + displacement);
 }
 
-inline interval operator+(double displacement, const interval& ival) {
+template<typename T>
+inline basic_interval<T> operator+(double displacement, const basic_interval<T>& ival) {
     return ival + displacement;
 }
 
@@ -1,15 +1,31 @@
 #include "rtweekend.h"
+#include "animation.h"
+#include "arena.h"
 #include "camera.h"
 #include "hittable_list.h"
 #include "material.h"
 #include "sphere.h"
+#include "sphere_set.h"
+#include "box.h"
 #include "bvh.h"
+#include "quantized_bvh.h"
 #include "texture.h"
 #include "quad.h"
 #include "constant_medium.h"
+#include "checkpoint.h"
+#include "heatmap.h"
+#include "image_stream.h"
+#include "image_writer.h"
+#include "benchmark.h"
+#include "timing.h"
+#include "trace.h"
+#include "trace_observer.h"
 #include "raylib_window.h"
 
+#include <algorithm>
 #include <iostream>
+#include <optional>
+#include <random>
 #include <thread>
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bundled/core.h>
@@ -18,6 +34,7 @@
 #include <argparse/argparse.hpp>
 
 struct scene_info {
+    std::shared_ptr<scene_arena> arena = std::make_shared<scene_arena>(); // owns every object in the scene
     hittable_list world;
     double vfov = 20;
     point3 lookfrom = point3(1, 0, 1);
@@ -26,6 +43,7 @@ struct scene_info {
     double defocus_angle = 0;
     double focus_dist = 10;
     colour background = { 0.5, 0.5, 0.5 };
+    camera_path path; // for animations, empty keeps the camera still
 };
 
 static bool set_logging_level(const std::string& level) {
@@ -50,11 +68,13 @@ static bool set_logging_level(const std::string& level) {
 }
 
 scene_info random_spheres() {
+    scene_info scene;
+    auto& arena = *scene.arena;
     hittable_list world;
 
-    auto checker = make_shared<checker_texture>(0.32, colour(0.2, 0.3, 0.1), colour(0.9, 0.9, 0.9));
-    auto ground_material = make_shared<lambertian>(checker);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+    auto checker = arena.make<checker_texture>(0.32, colour(0.2, 0.3, 0.1), colour(0.9, 0.9, 0.9));
+    auto ground_material = arena.make<lambertian>(checker);
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, ground_material));
 
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -67,34 +87,33 @@ scene_info random_spheres() {
                 if (choose_mat < 0.8) {
                     // diffuse
                     auto albedo = colour::random() * colour::random();
-                    sphere_material = make_shared<lambertian>(albedo);
+                    sphere_material = arena.make<lambertian>(albedo);
                     auto center2 = center + vec3(0, random_double(0, 0.5), 0);
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
+                    world.add(arena.make<sphere>(center, center2, 0.2, sphere_material));
                 } else if (choose_mat < 0.95) {
                     // metal
                     auto albedo = colour::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<metal>(albedo, fuzz);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 } else {
                     // glass
-                    sphere_material = make_shared<dieletric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<dieletric>(1.5);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
             }
         }
     }
 
-    auto material1 = make_shared<dieletric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material1 = arena.make<dieletric>(1.5);
+    world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, material1));
 
-    auto material2 = make_shared<lambertian>(colour(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material2 = arena.make<lambertian>(colour(0.4, 0.2, 0.1));
+    world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, material2));
 
-    auto material3 = make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material3 = arena.make<metal>(colour(0.7, 0.6, 0.5), 0.0);
+    world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, material3));
 
-    scene_info scene;
     scene.world = world;
     scene.vfov = 20;
     scene.lookfrom = point3(13, 2, 3);
@@ -108,15 +127,16 @@ scene_info random_spheres() {
 }
 
 scene_info two_spheres() {
+    scene_info scene;
+    auto& arena = *scene.arena;
     hittable_list world;
 
-    auto checker = make_shared<checker_texture>(0.8, colour(0.2, 0.3, 0.1), colour(0.9, 0.9, 0.9));
-    auto checker_material = make_shared<lambertian>(checker);
+    auto checker = arena.make<checker_texture>(0.8, colour(0.2, 0.3, 0.1), colour(0.9, 0.9, 0.9));
+    auto checker_material = arena.make<lambertian>(checker);
 
-    world.add(make_shared<sphere>(point3(0, -10, 0), 10, checker_material));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, checker_material));
+    world.add(arena.make<sphere>(point3(0, -10, 0), 10, checker_material));
+    world.add(arena.make<sphere>(point3(0, 10, 0), 10, checker_material));
 
-    scene_info scene;
     scene.world = world;
     scene.vfov = 20;
     scene.lookfrom = point3(13, 2, 3);
@@ -130,15 +150,16 @@ scene_info two_spheres() {
 }
 
 scene_info earth() {
+    scene_info scene;
+    auto& arena = *scene.arena;
     hittable_list world;
 
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+    auto earth_texture = arena.make<image_texture>("earthmap.jpg");
+    auto earth_surface = arena.make<lambertian>(earth_texture);
+    auto globe = arena.make<sphere>(point3(0, 0, 0), 2, earth_surface);
 
     world.add(globe);
 
-    scene_info scene;
     scene.world = world;
     scene.vfov = 20;
     scene.lookfrom = point3(0, 0, 12);
@@ -153,10 +174,11 @@ scene_info earth() {
 
 scene_info two_perlin_spheres() {
     scene_info scene;
+    auto& arena = *scene.arena;
 
-    auto pertext = make_shared<noise_texture>(4);
-    scene.world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    scene.world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+    auto pertext = arena.make<noise_texture>(4);
+    scene.world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, arena.make<lambertian>(pertext)));
+    scene.world.add(arena.make<sphere>(point3(0, 2, 0), 2, arena.make<lambertian>(pertext)));
 
     scene.vfov = 20;
     scene.lookfrom = point3(13, 2, 3);
@@ -171,18 +193,19 @@ scene_info two_perlin_spheres() {
 
 scene_info quads() {
     scene_info scene;
+    auto& arena = *scene.arena;
 
-    auto left_red = make_shared<lambertian>(colour(1.0, 0.2, 0.2));
-    auto back_green = make_shared<lambertian>(colour(0.2, 1.0, 0.2));
-    auto right_blue = make_shared<lambertian>(colour(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(colour(1.0, 0.5, 0.0));
-    auto lower_teal = make_shared<lambertian>(colour(0.2, 0.8, 0.8));
+    auto left_red = arena.make<lambertian>(colour(1.0, 0.2, 0.2));
+    auto back_green = arena.make<lambertian>(colour(0.2, 1.0, 0.2));
+    auto right_blue = arena.make<lambertian>(colour(0.2, 0.2, 1.0));
+    auto upper_orange = arena.make<lambertian>(colour(1.0, 0.5, 0.0));
+    auto lower_teal = arena.make<lambertian>(colour(0.2, 0.8, 0.8));
 
-    scene.world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-    scene.world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0,  0), vec3(0, 4, 0), back_green));
-    scene.world.add(make_shared<quad>(point3( 3, -2, 1), vec3(0, 0,  4), vec3(0, 4, 0), right_blue));
-    scene.world.add(make_shared<quad>(point3(-2,  3, 1), vec3(4, 0,  0), vec3(0, 0, 4), upper_orange));
-    scene.world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0,  0), vec3(0, 0,-4), lower_teal));
+    scene.world.add(arena.make<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
+    scene.world.add(arena.make<quad>(point3(-2, -2, 0), vec3(4, 0,  0), vec3(0, 4, 0), back_green));
+    scene.world.add(arena.make<quad>(point3( 3, -2, 1), vec3(0, 0,  4), vec3(0, 4, 0), right_blue));
+    scene.world.add(arena.make<quad>(point3(-2,  3, 1), vec3(4, 0,  0), vec3(0, 0, 4), upper_orange));
+    scene.world.add(arena.make<quad>(point3(-2, -3, 5), vec3(4, 0,  0), vec3(0, 0,-4), lower_teal));
 
     scene.vfov = 80;
     scene.lookfrom = point3(0, 0, 9);
@@ -197,14 +220,15 @@ scene_info quads() {
 
 scene_info simple_light() {
     scene_info scene;
+    auto& arena = *scene.arena;
 
-    auto pertext = make_shared<noise_texture>(4);
-    scene.world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    scene.world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+    auto pertext = arena.make<noise_texture>(4);
+    scene.world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, arena.make<lambertian>(pertext)));
+    scene.world.add(arena.make<sphere>(point3(0, 2, 0), 2, arena.make<lambertian>(pertext)));
 
-    auto difflight = make_shared<diffuse_light>(colour(4, 4, 4));
-    scene.world.add(make_shared<sphere>(point3(0, 7, 0), 2, difflight));
-    scene.world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
+    auto difflight = arena.make<diffuse_light>(colour(4, 4, 4));
+    scene.world.add(arena.make<sphere>(point3(0, 7, 0), 2, difflight));
+    scene.world.add(arena.make<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
 
     scene.vfov = 20;
     scene.lookfrom = point3(26, 3, 6);
@@ -218,27 +242,24 @@ scene_info simple_light() {
 
 scene_info cornell_box() {
     scene_info scene;
+    auto& arena = *scene.arena;
+
+    auto red = arena.make<lambertian>(colour(0.65, 0.05, 0.05));
+    auto white = arena.make<lambertian>(colour(0.73, 0.73, 0.73));
+    auto green = arena.make<lambertian>(colour(0.12, 0.45, 0.15));
+    auto light = arena.make<diffuse_light>(colour(15, 15, 15));
+
+    scene.world.add(arena.make<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    scene.world.add(arena.make<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    scene.world.add(arena.make<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    scene.world.add(arena.make<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    scene.world.add(arena.make<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    scene.world.add(arena.make<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
 
-    auto red = make_shared<lambertian>(colour(0.65, 0.05, 0.05));
-    auto white = make_shared<lambertian>(colour(0.73, 0.73, 0.73));
-    auto green = make_shared<lambertian>(colour(0.12, 0.45, 0.15));
-    auto light = make_shared<diffuse_light>(colour(15, 15, 15));
-
-    scene.world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    scene.world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    scene.world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
-    scene.world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    scene.world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-    scene.world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    shared_ptr<hittable> box1 = arena.make<box_primitive>(point3(0, 0, 0), point3(165, 330, 165), white, 15, vec3(265, 0, 295));
     scene.world.add(box1);
 
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    shared_ptr<hittable> box2 = arena.make<box_primitive>(point3(0, 0, 0), point3(165, 165, 165), white, -18, vec3(130, 0, 65));
     scene.world.add(box2);
 
     scene.vfov = 40;
@@ -253,29 +274,26 @@ scene_info cornell_box() {
 
 scene_info cornell_smoke() {
     scene_info scene;
+    auto& arena = *scene.arena;
 
-    auto red = make_shared<lambertian>(colour(0.65, 0.05, 0.05));
-    auto white = make_shared<lambertian>(colour(0.73, 0.73, 0.73));
-    auto green = make_shared<lambertian>(colour(0.12, 0.45, 0.15));
-    auto light = make_shared<diffuse_light>(colour(15, 15, 15));
+    auto red = arena.make<lambertian>(colour(0.65, 0.05, 0.05));
+    auto white = arena.make<lambertian>(colour(0.73, 0.73, 0.73));
+    auto green = arena.make<lambertian>(colour(0.12, 0.45, 0.15));
+    auto light = arena.make<diffuse_light>(colour(15, 15, 15));
 
-    scene.world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    scene.world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    scene.world.add(make_shared<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
-    scene.world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    scene.world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-    scene.world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+    scene.world.add(arena.make<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    scene.world.add(arena.make<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    scene.world.add(arena.make<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
+    scene.world.add(arena.make<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    scene.world.add(arena.make<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    scene.world.add(arena.make<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
 
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    shared_ptr<hittable> box1 = arena.make<box_primitive>(point3(0, 0, 0), point3(165, 330, 165), white, 15, vec3(265, 0, 295));
 
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    shared_ptr<hittable> box2 = arena.make<box_primitive>(point3(0, 0, 0), point3(165, 165, 165), white, -18, vec3(130, 0, 65));
 
-    scene.world.add(make_shared<constant_medium>(box1, 0.01, colour(0, 0, 0)));
-    scene.world.add(make_shared<constant_medium>(box2, 0.01, colour(1, 1, 1)));
+    scene.world.add(arena.make<constant_medium>(box1, 0.01, colour(0, 0, 0)));
+    scene.world.add(arena.make<constant_medium>(box2, 0.01, colour(1, 1, 1)));
 
     scene.vfov = 40;
     scene.lookfrom = point3(278, 278, -800);
@@ -288,9 +306,10 @@ scene_info cornell_smoke() {
 
 scene_info final_scene() {
     scene_info scene;
+    auto& arena = *scene.arena;
 
     hittable_list boxes1;
-    auto ground = make_shared<lambertian>(colour(0.48, 0.83, 0.53));
+    auto ground = arena.make<lambertian>(colour(0.48, 0.83, 0.53));
 
     int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; i += 1) {
@@ -303,44 +322,50 @@ scene_info final_scene() {
             auto y1 = random_double(1, 101);
             auto z1 = z0 + w;
 
-            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+            boxes1.add(arena.make<box_primitive>(point3(x0, y0, z0), point3(x1, y1, z1), ground));
         }
     }
 
-    scene.world.add(make_shared<bvh_node>(boxes1));
+    scene.world.add(arena.make<bvh_node>(boxes1, &arena));
 
-    auto light = make_shared<diffuse_light>(colour(7, 7, 7));
-    scene.world.add(make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
+    auto light = arena.make<diffuse_light>(colour(7, 7, 7));
+    scene.world.add(arena.make<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
 
     auto center1 = point3(400, 400, 200);
     auto center2 = center1 + vec3(30, 0, 0);
-    auto sphere_material = make_shared<lambertian>(colour(0.7, 0.3, 0.1));
-    scene.world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
+    auto sphere_material = arena.make<lambertian>(colour(0.7, 0.3, 0.1));
+    scene.world.add(arena.make<sphere>(center1, center2, 50, sphere_material));
 
-    scene.world.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dieletric>(1.5)));
-    scene.world.add(make_shared<sphere>(point3(0, 150, 145), 50, make_shared<metal>(colour(0.8, 0.8, 0.9), 1.0)));
+    scene.world.add(arena.make<sphere>(point3(260, 150, 45), 50, arena.make<dieletric>(1.5)));
+    scene.world.add(arena.make<sphere>(point3(0, 150, 145), 50, arena.make<metal>(colour(0.8, 0.8, 0.9), 1.0)));
 
-    auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dieletric>(1.5));
+    auto boundary = arena.make<sphere>(point3(360, 150, 145), 70, arena.make<dieletric>(1.5));
     scene.world.add(boundary);
-    scene.world.add(make_shared<constant_medium>(boundary, 0.2, colour(0.2, 0.4, 0.9)));
+    scene.world.add(arena.make<constant_medium>(boundary, 0.2, colour(0.2, 0.4, 0.9)));
 
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dieletric>(1.5));
-    scene.world.add(make_shared<constant_medium>(boundary, 0.0001, colour(1, 1, 1)));
+    boundary = arena.make<sphere>(point3(0, 0, 0), 5000, arena.make<dieletric>(1.5));
+    scene.world.add(arena.make<constant_medium>(boundary, 0.0001, colour(1, 1, 1)));
 
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    scene.world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
+    auto emat = arena.make<lambertian>(arena.make<image_texture>("earthmap.jpg"));
+    scene.world.add(arena.make<sphere>(point3(400, 200, 400), 100, emat));
 
-    auto pertext = make_shared<noise_texture>(0.1);
-    scene.world.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+    auto pertext = arena.make<noise_texture>(0.1);
+    scene.world.add(arena.make<sphere>(point3(220, 280, 300), 80, arena.make<lambertian>(pertext)));
 
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(colour(0.73, 0.73, 0.73));
+    auto boxes2 = arena.make<sphere_set>();
+    auto white = arena.make<lambertian>(colour(0.73, 0.73, 0.73));
     int ns = 1000;
     for (int j = 0; j < ns; j += 1) {
-        boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
+        boxes2->add(point3::random(0, 165), 10, white);
     }
+    boxes2->build();
 
-    scene.world.add(make_shared<translate>(make_shared<rotate_y>(make_shared<bvh_node>(boxes2), 15), vec3(-100, 270, 395)));
+    // the cluster of spheres turns once over an animation
+    auto cluster_keys = std::vector<transform_keyframe>{
+        { 0, vec3(-100, 270, 395), 15 },
+        { 1, vec3(-100, 270, 395), 375 },
+    };
+    scene.world.add(arena.make<animated_instance>(boxes2, cluster_keys));
 
     scene.vfov = 40;
     scene.lookfrom = point3(478, 278, -600);
@@ -351,6 +376,19 @@ scene_info final_scene() {
     return scene;
 }
 
+uint64_t hash_scene(int n, const hittable_list& world) {
+    // there is no scene description to hash, so identify it by its objects and their bounds
+    uint64_t h = hash_combine(n, world.objects.size());
+    for (const auto& object : world.objects) {
+        auto bbox = object->bounding_box();
+        for (int a = 0; a < 3; a += 1) {
+            h = hash_combine(h, static_cast<uint64_t>(std::llround(bbox.axis(a).min * 1000)));
+            h = hash_combine(h, static_cast<uint64_t>(std::llround(bbox.axis(a).max * 1000)));
+        }
+    }
+    return h;
+}
+
 scene_info get_scene(int n) {
     switch (n) {
         case 1: return random_spheres();
@@ -366,6 +404,379 @@ scene_info get_scene(int n) {
     return {};
 }
 
+scene_info build_scene(int n) {
+    trace_zone zone("scene build", "scene");
+    zone.arg("scene", n);
+    return get_scene(n);
+}
+
+// Objects that dwarf the rest of the scene, like a ground sphere or a medium around everything,
+// are kept out of the bvh. Every node above one of them covers the whole scene, so almost every
+// ray gets into it and pays for the nodes beside it too. Taken largest first, an object is left
+// out while its bounds have more than huge_ratio times the area of all the smaller objects
+// together, or are infinite. The rest are returned and the huge ones added to outside
+hittable_list split_huge_objects(const hittable_list& objects, hittable_list& outside) {
+    constexpr double huge_ratio = 10;
+    constexpr size_t max_outside = 8; // every ray tests all of them
+
+    auto count = objects.objects.size();
+    std::vector<size_t> order(count);
+    std::vector<double> areas(count);
+    for (size_t i = 0; i < count; i += 1) {
+        order[i] = i;
+        areas[i] = objects.objects[i]->bounding_box().area();
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return areas[a] > areas[b];
+    });
+
+    // rest[i] is the area around the objects smaller than the ith largest
+    std::vector<double> rest(count, 0);
+    aabb smaller;
+    for (size_t i = count; i-- > 1;) {
+        smaller = aabb(smaller, objects.objects[order[i]]->bounding_box());
+        rest[i - 1] = smaller.area();
+    }
+
+    std::vector<bool> huge(count, false);
+    for (size_t i = 0; i + 1 < count && i < max_outside; i += 1) {
+        // with two unbounded objects rest is infinite too, so they're let out by themselves
+        auto unbounded = !std::isfinite(areas[order[i]]);
+        if (!unbounded && !(areas[order[i]] > huge_ratio * rest[i])) {
+            break;
+        }
+        huge[order[i]] = true;
+    }
+
+    hittable_list inside;
+    for (size_t i = 0; i < count; i += 1) {
+        if (huge[i]) {
+            outside.add(objects.objects[i]);
+        } else {
+            inside.add(objects.objects[i]);
+        }
+    }
+    return inside;
+}
+
+// the quantized bvh takes a fraction of the memory of bvh_node, for scenes that wouldn't fit,
+// and can split large objects between its nodes with split_budget
+hittable_list build_bvh(const scene_info& scene, bool quantized = false, double split_budget = 0, double* bytes_per_object = nullptr) {
+    using namespace fmt;
+
+    trace_zone zone("bvh build", "scene");
+    zone.arg("objects", static_cast<long long>(scene.world.objects.size()));
+
+    hittable_list outside;
+    auto objects = split_huge_objects(scene.world, outside);
+
+    auto& arena = *scene.arena;
+    size_t bytes = 0;
+    hittable_list world;
+    if (quantized || split_budget > 0) {
+        auto bvh = arena.make<quantized_bvh>(objects, split_budget);
+        bytes = bvh->bytes_used();
+        world.add(bvh);
+    } else {
+        world.add(arena.make<bvh_node>(objects, &arena));
+        bytes = bvh_node::bytes_used(objects.objects.size());
+    }
+    for (const auto& object : outside.objects) {
+        world.add(object);
+    }
+    arena.log_usage();
+
+    auto per_object = static_cast<double>(bytes) / std::max<size_t>(1, objects.objects.size());
+    spdlog::debug("BVH over {} objects: {} per object", objects.objects.size(), format(fg(color::aqua), "{:.1f} bytes", per_object));
+    if (bytes_per_object != nullptr) {
+        *bytes_per_object = per_object;
+    }
+    return world;
+}
+
+struct huge_object_gain {
+    size_t huge_objects = 0;
+    double tests = 0;
+    double tests_with_huge = 0;
+};
+
+// How many nodes and objects a ray that gets into the scene's bounds is expected to test, by
+// surface area cost, with the huge objects in the bvh and with them tested beside it. Both are
+// measured on bvh_node trees built for the purpose, so this isn't part of build_bvh
+huge_object_gain measure_huge_objects(const scene_info& scene) {
+    using namespace fmt;
+
+    trace_zone zone("bvh quality", "scene");
+
+    huge_object_gain gain;
+    hittable_list outside;
+    auto objects = split_huge_objects(scene.world, outside);
+    gain.huge_objects = outside.objects.size();
+    if (gain.huge_objects == 0) {
+        return gain;
+    }
+
+    bvh_node with(scene.world);
+    bvh_node without(objects);
+    auto area = scene.world.bounding_box().area();
+    if (std::isfinite(area)) {
+        gain.tests_with_huge = with.surface_area_cost() / area;
+        gain.tests = gain.huge_objects + without.surface_area_cost() / area;
+    } else {
+        // every ray gets into the nodes over an unbounded object, so that tree costs without
+        // limit, and the rest is measured from its own bounds
+        gain.tests_with_huge = infinity;
+        gain.tests = gain.huge_objects + without.cost_ratio();
+    }
+
+    spdlog::info("Testing {} huge objects beside the bvh: {} per ray, against {} with them in it",
+        gain.huge_objects,
+        format(fg(color::aqua), "{:.2f} tests", gain.tests),
+        format(fg(color::aqua), "{:.2f}", gain.tests_with_huge));
+    return gain;
+}
+
+void set_scene_camera(camera& cam, const scene_info& scene) {
+    cam.vfov = scene.vfov;
+    cam.lookfrom = scene.lookfrom;
+    cam.lookat = scene.lookat;
+    cam.vup = scene.vup;
+    cam.defocus_angle = scene.defocus_angle;
+    cam.focus_dist = scene.focus_dist;
+    cam.background = scene.background;
+}
+
+int render_to_file(camera& cam, const hittable& world, const std::string& filename, int threads) {
+    // renders the whole frame without a window, then encodes it on the executor
+    image_format format;
+    if (!image_format_from_filename(filename, format)) {
+        spdlog::error("Unsupported image format: {}, use .png, .qoi, .ppm or .pfm", filename);
+        return 1;
+    }
+
+    tf::Executor executor(threads);
+    if (trace::enabled()) {
+        executor.make_observer<trace_observer>();
+    }
+
+    auto dims = cam.get_image_dimensions();
+    auto bmp = std::make_shared<bitmap>(dims.width, dims.height);
+
+    tf::Taskflow taskflow;
+    taskflow.emplace([&world, &cam, bmp](tf::Subflow subflow) {
+        cam.render(world, subflow, bmp);
+    });
+    executor.run(taskflow).wait();
+
+    if (!cam.complete()) {
+        return 1;
+    }
+
+    async_image_writer writer(executor);
+    writer.submit(filename, cam.capture_image(*bmp));
+    return writer.wait() ? 0 : 1;
+}
+
+std::string numbered_filename(const std::string& filename, int frame) {
+    // render.png becomes render_0007.png
+    auto dot = filename.find_last_of('.');
+    auto slash = filename.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        dot = filename.size();
+    }
+    return fmt::format("{}_{:04}{}", filename.substr(0, dot), frame, filename.substr(dot));
+}
+
+int render_animation(camera& cam, hittable& world, const camera_path& path, const std::string& filename, int frames, int threads) {
+    // Frames are pipelined: while frame n traces, the scene for frame n + 1 is prepared next
+    // to it and frame n - 1 is still being encoded by the writer. Between frames only the
+    // commit, which swaps in the prepared transforms and refitted bounds, runs on its own.
+    using namespace fmt;
+
+    image_format file_format;
+    if (!image_format_from_filename(filename, file_format)) {
+        spdlog::error("Unsupported image format: {}, use .png, .qoi, .ppm or .pfm", filename);
+        return 1;
+    }
+
+    tf::Executor executor(threads);
+    if (trace::enabled()) {
+        executor.make_observer<trace_observer>();
+    }
+
+    auto dims = cam.get_image_dimensions();
+    auto bmp = std::make_shared<bitmap>(dims.width, dims.height);
+    async_image_writer writer(executor);
+
+    animation anim;
+    anim.path = path;
+    anim.prepare(world, animation::frame_time(0, frames));
+    anim.commit(world, cam);
+
+    spdlog::info("Rendering {} frames to {}", frames, numbered_filename(filename, 0));
+
+    timer time;
+    double trace_ms = 0;
+
+    for (int frame = 0; frame < frames; frame += 1) {
+        trace_zone zone("frame", "scene");
+        zone.arg("frame", frame);
+
+        timer frame_time;
+
+        tf::Taskflow taskflow;
+        taskflow.emplace([&world, &cam, bmp](tf::Subflow& subflow) {
+            cam.render(world, subflow, bmp);
+        }).name("trace");
+        if (frame + 1 < frames) {
+            taskflow.emplace([&anim, &world, frame, frames]() {
+                anim.prepare(world, animation::frame_time(frame + 1, frames));
+            }).name("scene update");
+        }
+        executor.run(taskflow).wait();
+        trace_ms += frame_time.duration<timer::milliseconds>();
+
+        if (!cam.complete()) {
+            return 1;
+        }
+
+        // a slow encoder shouldn't end up holding every frame in memory
+        writer.throttle(std::max(2, threads));
+        writer.submit(numbered_filename(filename, frame), cam.capture_image(*bmp, file_format == image_format::pfm));
+
+        if (frame + 1 < frames) {
+            anim.commit(world, cam);
+        }
+    }
+
+    auto ok = writer.wait();
+
+    auto diff = time.duration<timer::milliseconds>();
+    spdlog::info("Rendered {} frames in {}, {} per frame outside tracing", frames,
+        format(fg(color::aqua), "{:.2f}ms", diff), format(fg(color::aqua), "{:.2f}ms", (diff - trace_ms) / frames));
+    return ok ? 0 : 1;
+}
+
+int stream_to_file(camera& cam, const hittable& world, const std::string& filename, int threads, int band_height) {
+    // for frames too big to hold in memory, see camera::render_to_stream
+    auto dims = cam.get_image_dimensions();
+    auto stream = open_image_stream(filename, dims.width, dims.height);
+    if (!stream) {
+        return 1;
+    }
+
+    tf::Executor executor(threads);
+    if (trace::enabled()) {
+        executor.make_observer<trace_observer>();
+    }
+
+    auto rendered = cam.render_to_stream(world, executor, *stream, band_height);
+    auto written = stream->finish();
+    if (written) {
+        spdlog::info("Wrote {}", filename);
+    }
+    return rendered && written ? 0 : 1;
+}
+
+int run_benchmark(const benchmark_settings& settings, const std::string& out_file, std::optional<std::string> compare_file, double threshold) {
+    // renders every built in scene headless with fixed settings so runs are comparable
+    using namespace fmt;
+
+    std::vector<benchmark_result> baseline;
+    if (compare_file && !read_benchmark_results(*compare_file, baseline)) {
+        return 1;
+    }
+
+    spdlog::info("Running benchmark: {} spp, max depth {}, seed {}, {} threads", settings.samples_per_pixel, settings.max_depth, settings.seed, settings.threads);
+
+    tf::Executor executor(settings.threads);
+    if (trace::enabled()) {
+        executor.make_observer<trace_observer>();
+    }
+
+    std::vector<benchmark_result> results;
+    auto run_settings = settings;
+    run_settings.peak_rss_per_scene = true;
+
+    for (int n = 1; n <= 9; n += 1) {
+        benchmark_result result;
+        result.scene = n;
+
+        // the peak of one scene, not of every scene so far, where the platform allows it
+        run_settings.peak_rss_per_scene = reset_peak_rss() && run_settings.peak_rss_per_scene;
+
+        timer wall_time;
+
+        seed_random(settings.seed);
+
+        timer scene_time;
+        auto scene = build_scene(n);
+        result.scene_build_ms = scene_time.duration<timer::milliseconds>();
+
+        timer bvh_time;
+        auto world = build_bvh(scene, settings.quantized_bvh, settings.split_budget, &result.bvh_bytes_per_object);
+        result.bvh_build_ms = bvh_time.duration<timer::milliseconds>();
+
+        auto gain = measure_huge_objects(scene);
+        result.huge_objects = gain.huge_objects;
+        result.bvh_tests = gain.tests;
+        result.bvh_tests_with_huge = gain.tests_with_huge;
+
+        camera cam;
+        cam.aspect_ratio = settings.aspect_ratio;
+        cam.image_width = settings.image_width;
+        cam.samples_per_pixel = settings.samples_per_pixel;
+        cam.max_depth = settings.max_depth;
+        cam.seed = settings.seed;
+        cam.packet_size = settings.packet_size;
+        cam.wavefront = settings.wavefront;
+        cam.sort_rays = settings.sort_rays;
+        set_scene_camera(cam, scene);
+        cam.init();
+
+        auto dims = cam.get_image_dimensions();
+        auto bmp = std::make_shared<bitmap>(dims.width, dims.height);
+
+        tf::Taskflow taskflow;
+        taskflow.emplace([&](tf::Subflow& subflow) {
+            cam.render(world, subflow, bmp);
+        });
+
+        timer render_time;
+        executor.run(taskflow).wait();
+        result.render_ms = render_time.duration<timer::milliseconds>();
+
+        result.wall_ms = wall_time.duration<timer::milliseconds>();
+        result.rays = cam.rays_traced();
+        result.mrays_per_second = result.rays / (result.render_ms * 1000.0);
+        result.peak_rss_kb = peak_rss_kb();
+
+        spdlog::info("Scene {}: {} ({} rays in {:.2f}ms, bvh build {:.2f}ms, peak rss {}KB)", n,
+            format(fg(color::aqua), "{:.2f} Mrays/s", result.mrays_per_second),
+            result.rays, result.render_ms, result.bvh_build_ms, result.peak_rss_kb);
+
+        results.push_back(result);
+    }
+
+    if (!run_settings.peak_rss_per_scene) {
+        spdlog::warn("Peak RSS can't be reset here, each scene's is the peak of the run so far");
+    }
+
+    if (!write_benchmark_results(out_file, run_settings, results)) {
+        return 1;
+    }
+
+    if (compare_file) {
+        spdlog::info("Comparing against {} (threshold {:.1f}%):", *compare_file, threshold);
+        if (!compare_benchmark_results(baseline, results, threshold)) {
+            spdlog::error("Performance regression detected");
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     spdlog::set_level(spdlog::level::info);
 
@@ -384,6 +795,137 @@ int main(int argc, char* argv[]) {
         // .choices("trace", "debug", "info", "warn", "err", "critical", "off")
         .nargs(1);
 
+    program.add_argument("--seed")
+        .help("Seed for the random number generator, makes renders reproducible")
+        .nargs(1)
+        .scan<'u', uint64_t>();
+
+    program.add_argument("--checkpoint")
+        .help("Periodically save the render state to this file")
+        .nargs(1);
+
+    program.add_argument("--checkpoint-interval")
+        .help("Number of seconds between checkpoints")
+        .default_value(30.0)
+        .nargs(1)
+        .scan<'g', double>();
+
+    program.add_argument("--resume")
+        .help("Resume rendering from a checkpoint file")
+        .nargs(1);
+
+    program.add_argument("--trace")
+        .help("Write a Chrome trace event timeline to this file, viewable in Perfetto")
+        .nargs(1);
+
+    program.add_argument("-o", "--output")
+        .help("Render without a window and write the image to this file (.png, .qoi, .ppm or .pfm)")
+        .nargs(1);
+
+    program.add_argument("--stream")
+        .help("With --output, render in bands of rows and write each as it finishes (.ppm or .png only)")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--save-as")
+        .help("File the window's Save Image button writes to (.png, .qoi, .ppm or .pfm)")
+        .default_value(std::string("render.png"))
+        .nargs(1);
+
+    program.add_argument("--frames")
+        .help("With --output, render this many frames of the scene's animation, numbering the files")
+        .default_value(1)
+        .nargs(1)
+        .scan<'i', int>();
+
+    program.add_argument("--turntable")
+        .help("Orbit the camera once around the scene over the animation")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--width")
+        .help("Image width in pixels")
+        .default_value(1024)
+        .nargs(1)
+        .scan<'i', int>();
+
+    program.add_argument("--samples")
+        .help("Samples per pixel")
+        .default_value(20)
+        .nargs(1)
+        .scan<'i', int>();
+
+    program.add_argument("--band-height")
+        .help("Rows rendered and written at a time with --stream")
+        .default_value(64)
+        .nargs(1)
+        .scan<'i', int>();
+
+    program.add_argument("--heatmap")
+        .help("Render a per pixel cost heatmap instead of the image: nodes, primitives or cycles")
+        .nargs(1);
+
+    program.add_argument("--interactive")
+        .help("Start with the progressive preview on, so moving the camera renders at low resolution")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--packet-size")
+        .help("Trace primary rays in packets of this many pixels square, up to 8, 1 traces them one at a time")
+        .default_value(8)
+        .nargs(1)
+        .scan<'i', int>();
+
+    program.add_argument("--wavefront")
+        .help("Trace paths in waves, one stage at a time for all of them, instead of each path to its end in turn")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--sort-rays")
+        .help("Sort secondary rays by where they start and the way they head before tracing them, implies --wavefront")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--quantized-bvh")
+        .help("Store the scene bvh with 8-bit child bounds, a fraction of the memory for a little more traversal work")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--spatial-splits")
+        .help("Let the bvh split large objects between nodes, adding up to this many references per object, implies --quantized-bvh")
+        .nargs(1)
+        .scan<'g', double>();
+
+    program.add_argument("--max-depth")
+        .help("Bounces per path, defaults to 5 and to 8 for --benchmark")
+        .nargs(1)
+        .scan<'i', int>();
+
+    program.add_argument("--reuse-samples")
+        .help("Reproject samples from the previous render when the camera moves instead of starting over")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--benchmark")
+        .help("Render every built in scene headless and report performance as JSON")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--benchmark-out")
+        .help("File to write benchmark results to, use - for stdout")
+        .default_value(std::string("benchmark.json"))
+        .nargs(1);
+
+    program.add_argument("--benchmark-compare")
+        .help("Previous benchmark results to compare against, exits non-zero on regressions")
+        .nargs(1);
+
+    program.add_argument("--benchmark-threshold")
+        .help("Allowed drop in Mrays/s, in percent, before a scene counts as a regression")
+        .default_value(5.0)
+        .nargs(1)
+        .scan<'g', double>();
+
     try {
         program.parse_args(argc, argv);
     } catch(const std::exception& err) {
@@ -405,31 +947,140 @@ int main(int argc, char* argv[]) {
 
     spdlog::info("Starting raytracer!");
 
-    auto scene = get_scene(9);
-    auto world = hittable_list(make_shared<bvh_node>(scene.world));
+    auto trace_file = program.present("--trace");
+    if (trace_file) {
+        trace::enable();
+        trace::set_thread_name("main");
+    }
+
+    if (program.get<bool>("--benchmark")) {
+        benchmark_settings settings;
+        settings.threads = program.get<int>("--threads");
+        settings.packet_size = program.get<int>("--packet-size");
+        settings.sort_rays = program.get<bool>("--sort-rays");
+        settings.wavefront = program.get<bool>("--wavefront") || settings.sort_rays;
+        settings.quantized_bvh = program.get<bool>("--quantized-bvh");
+        settings.split_budget = program.present<double>("--spatial-splits").value_or(0);
+        if (auto depth = program.present<int>("--max-depth")) {
+            settings.max_depth = *depth;
+        }
+        if (auto seed_arg = program.present<uint64_t>("--seed")) {
+            settings.seed = *seed_arg;
+        }
+
+        auto result = run_benchmark(settings, program.get("--benchmark-out"), program.present("--benchmark-compare"), program.get<double>("--benchmark-threshold"));
+        if (trace_file) {
+            trace::write(*trace_file);
+        }
+        return result;
+    }
+
+    auto mode = render_mode::beauty;
+    if (auto heatmap = program.present("--heatmap")) {
+        if (!parse_render_mode(*heatmap, mode) || mode == render_mode::beauty) {
+            std::cerr << fmt::format("Invalid argument \"{}\" - allowed options: {{nodes, primitives, cycles}}", *heatmap) << std::endl;
+            std::cerr << program;
+            return 1;
+        }
+    }
+
+    std::optional<checkpoint> resume_checkpoint;
+    auto checkpoint_file = program.present("--checkpoint");
+    if (auto resume_file = program.present("--resume")) {
+        checkpoint ckpt;
+        if (!read_checkpoint(*resume_file, ckpt)) {
+            return 1;
+        }
+        resume_checkpoint = std::move(ckpt);
+
+        if (!checkpoint_file) {
+            checkpoint_file = resume_file;
+        }
+    }
+
+    // a checkpoint can only be resumed if the scene and samples can be regenerated exactly
+    uint64_t seed = 0;
+    if (resume_checkpoint) {
+        seed = resume_checkpoint->header.seed;
+    } else if (auto seed_arg = program.present<uint64_t>("--seed")) {
+        seed = *seed_arg;
+    } else if (checkpoint_file) {
+        std::random_device rd;
+        seed = (static_cast<uint64_t>(rd()) << 32) | rd() | 1;
+    }
+
+    if (seed != 0) {
+        spdlog::info("Using seed {}", seed);
+        seed_random(seed);
+    }
+
+    int scene_id = 9;
+    auto scene = build_scene(scene_id);
+    auto scene_hash = hash_scene(scene_id, scene.world);
+    auto world = build_bvh(scene, program.get<bool>("--quantized-bvh"), program.present<double>("--spatial-splits").value_or(0));
+    measure_huge_objects(scene);
+    if (program.get<bool>("--turntable")) {
+        scene.path = camera_path::turntable(scene.lookfrom, scene.lookat);
+    }
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 1024;
-    cam.samples_per_pixel = 20;
+    cam.image_width = program.get<int>("--width");
+    cam.samples_per_pixel = program.get<int>("--samples");
     cam.max_depth = 5;
-    cam.vfov = scene.vfov;
-    cam.lookfrom = scene.lookfrom;
-    cam.lookat = scene.lookat;
-    cam.vup = scene.vup;
-    cam.defocus_angle = scene.defocus_angle;
-    cam.focus_dist = scene.focus_dist;
-    cam.background = scene.background;
+    set_scene_camera(cam, scene);
+    cam.seed = seed;
+    cam.scene_hash = scene_hash;
+    cam.mode = mode;
+    cam.reuse_samples = program.get<bool>("--reuse-samples");
+    cam.packet_size = program.get<int>("--packet-size");
+    cam.sort_rays = program.get<bool>("--sort-rays");
+    cam.wavefront = program.get<bool>("--wavefront") || cam.sort_rays;
+    if (auto depth = program.present<int>("--max-depth")) {
+        cam.max_depth = *depth;
+    }
+    if (checkpoint_file) {
+        cam.checkpoint_file = *checkpoint_file;
+        cam.checkpoint_interval = program.get<double>("--checkpoint-interval");
+    }
+    if (resume_checkpoint) {
+        cam.resume(std::move(*resume_checkpoint));
+    }
     cam.init();
 
     auto dims = cam.get_image_dimensions();
+
+    if (auto output_file = program.present("--output")) {
+        int result;
+        auto frames = program.get<int>("--frames");
+        if (frames > 1) {
+            result = render_animation(cam, world, scene.path, *output_file, frames, program.get<int>("--threads"));
+        } else if (program.get<bool>("--stream")) {
+            result = stream_to_file(cam, world, *output_file, program.get<int>("--threads"), std::max(1, program.get<int>("--band-height")));
+        } else {
+            result = render_to_file(cam, world, *output_file, program.get<int>("--threads"));
+        }
+
+        if (trace_file) {
+            trace::write(*trace_file);
+        }
+        return result;
+    }
+
     auto bmp = std::make_shared<bitmap>(dims.width, dims.height);
 
     raylib_window rw;
     rw.num_threads = program.get<int>("--threads");
+    rw.start_interactive = program.get<bool>("--interactive");
     rw.log_level = program.get("--log-level");
+    rw.render_on_start = cam.resuming();
+    rw.save_file = program.get("--save-as");
     rw.run(cam, world, bmp);
 
+    if (trace_file) {
+        trace::write(*trace_file);
+    }
+
     spdlog::info("Done!");
 
     return 0;
@@ -8,13 +8,30 @@
 #include "texture.h"
 
 #include <algorithm>
+#include <cstdint>
 
 class hit_record;
 
+// lets the wavefront integrator shade every hit on one kind of material in a single loop,
+// where the calls to the final class's scatter aren't virtual. anything else is shaded
+// through the virtual calls
+enum class material_kind : uint8_t {
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light,
+    isotropic,
+    other,
+};
+
 class material {
 public:
     virtual ~material() = default;
 
+    virtual material_kind kind() const {
+        return material_kind::other;
+    }
+
     virtual colour emitted(double u, double v, const point3& p) const {
         return colour(0, 0, 0);
     }
@@ -25,7 +42,7 @@ public:
     virtual colour get_colour() const = 0;
 };
 
-class lambertian : public material {
+class lambertian final : public material {
 public:
     lambertian(const colour& a) : albedo(make_shared<solid_colour>(a)), col(a) {}
     lambertian(shared_ptr<texture> a) : albedo(a) {
@@ -46,11 +63,15 @@ public:
             scatter_direction = rec.normal;
         }
 
-        scattered = ray(rec.p, scatter_direction, r_in.time());
+        scattered = ray(rec.spawn_origin(scatter_direction), scatter_direction, r_in.time());
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
 
+    material_kind kind() const override {
+        return material_kind::lambertian;
+    }
+
     colour get_colour() const override {
         return col;
     }
@@ -60,17 +81,22 @@ private:
     colour col;
 };
 
-class metal : public material {
+class metal final : public material {
 public:
     metal(const colour& a, double f): albedo(a), fuzz(f < 1 ? f : 1) {};
 
     bool scatter(const ray& r_in, const hit_record& rec, colour& attenuation, ray& scattered) const override {
         auto reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
+        auto direction = reflected + fuzz * random_in_unit_sphere();
+        scattered = ray(rec.spawn_origin(direction), direction, r_in.time());
         attenuation = albedo;
         return dot(scattered.direction(), rec.normal) > 0;
     }
 
+    material_kind kind() const override {
+        return material_kind::metal;
+    }
+
     colour get_colour() const override {
         return albedo;
     }
@@ -80,7 +106,7 @@ private:
     double fuzz;
 };
 
-class dieletric : public material {
+class dieletric final : public material {
 public:
     dieletric(double index_of_refraction) : ir(index_of_refraction) {}
 
@@ -101,10 +127,14 @@ public:
             direction = refract(unit_direction, rec.normal, refraction_ratio);
         }
 
-        scattered = ray(rec.p, direction, r_in.time());
+        scattered = ray(rec.spawn_origin(direction), direction, r_in.time());
         return true;
     }
 
+    material_kind kind() const override {
+        return material_kind::dielectric;
+    }
+
     colour get_colour() const override {
         return colour { 0.5, 0.4, 0.6 };
     }
@@ -120,7 +150,7 @@ private:
     }
 };
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
 public:
     diffuse_light(shared_ptr<texture> a) : emit(a) {
         set_colour();
@@ -136,6 +166,10 @@ public:
         return emit->value(u, v, p);
     }
 
+    material_kind kind() const override {
+        return material_kind::diffuse_light;
+    }
+
     colour get_colour() const override {
         return col;
     }
@@ -159,7 +193,7 @@ private:
     }
 };
 
-class isotropic : public material {
+class isotropic final : public material {
 public:
     isotropic(colour c) : albedo(make_shared<solid_colour>(c)), col(c) {}
     isotropic(shared_ptr<texture> a) : albedo(a) {
@@ -173,11 +207,16 @@ public:
     }
 
     bool scatter(const ray& r_in, const hit_record& rec, colour& attenuation, ray& scattered) const override {
-        scattered = ray(rec.p, random_unit_vector(), r_in.time());
+        auto direction = random_unit_vector();
+        scattered = ray(rec.spawn_origin(direction), direction, r_in.time());
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
 
+    material_kind kind() const override {
+        return material_kind::isotropic;
+    }
+
     colour get_colour() const override {
         return col;
     }
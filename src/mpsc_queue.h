@@ -0,0 +1,71 @@
+#ifndef __MPSC_QUEUE_H__
+#define __MPSC_QUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Lock-free multiple producer, single consumer queue. Producers push onto an intrusive stack
+// with a single compare and swap, the consumer takes the whole stack in one exchange and
+// reverses it so items come out in the order they were pushed. Since nodes are never popped
+// one at a time there is no ABA problem.
+template<typename T>
+class mpsc_queue {
+public:
+    mpsc_queue() = default;
+
+    ~mpsc_queue() {
+        clear();
+    }
+
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    void push(T value) {
+        auto n = new node{ std::move(value), head.load(std::memory_order_relaxed) };
+        while (!head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    // consumer only, calls fn for every queued item and returns how many there were
+    template<typename F>
+    size_t drain(F&& fn) {
+        node* n = head.exchange(nullptr, std::memory_order_acquire);
+
+        node* ordered = nullptr;
+        while (n != nullptr) {
+            auto next = n->next;
+            n->next = ordered;
+            ordered = n;
+            n = next;
+        }
+
+        size_t count = 0;
+        while (ordered != nullptr) {
+            fn(std::move(ordered->value));
+            auto next = ordered->next;
+            delete ordered;
+            ordered = next;
+            count += 1;
+        }
+        return count;
+    }
+
+    void clear() {
+        drain([](T&&) {});
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct node {
+        T value;
+        node* next;
+    };
+
+    std::atomic<node*> head{nullptr};
+};
+
+#endif//__MPSC_QUEUE_H__
@@ -0,0 +1,33 @@
+#include "packet.h"
+#include "hittable_list.h"
+
+void hittable::hit_packet(ray_packet& packet, uint64_t active) const {
+    ray_packet::for_each(active, [&](int lane) {
+        packet.hit_single(lane, *this);
+    });
+}
+
+void hittable_list::hit_packet(ray_packet& packet, uint64_t active) const {
+    for (const auto& object : objects) {
+        object->hit_packet(packet, active);
+    }
+}
+
+const hittable* hittable_list::packet_entry(const ray_bounds& bounds) const {
+    if (!bounds.may_hit(bbox)) {
+        return nullptr;
+    }
+    // the packet may only reach one object, like the bvh when the huge objects kept beside it
+    // are out of view, so it can start inside that
+    const hittable* only = nullptr;
+    for (const auto& object : objects) {
+        if (!bounds.may_hit(object->bounding_box())) {
+            continue;
+        }
+        if (only != nullptr) {
+            return this;
+        }
+        only = object.get();
+    }
+    return only != nullptr ? only->packet_entry(bounds) : nullptr;
+}
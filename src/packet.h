@@ -0,0 +1,151 @@
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "aabb.h"
+
+#include <bitset>
+#include <cstdint>
+
+// Bounds on a bundle of rays, as intervals of their origins and reciprocal directions. A box is
+// tested with the usual slab test done in interval arithmetic, which gives a lower bound on
+// where any of the rays enters it and an upper bound on where any leaves. When those don't
+// overlap no ray in the bundle can hit the box, so this culls like a frustum around the
+// bundle, and still works when the origins are spread over a defocus disk.
+class ray_bounds {
+public:
+    ray_bounds() {}
+
+    ray_bounds(const point3& origin_min, const point3& origin_max, const vec3& direction_min, const vec3& direction_max)
+        : o_min(origin_min), o_max(origin_max)
+    {
+        for (int a = 0; a < 3; a += 1) {
+            // an axis where the directions straddle zero can't bound the slab distances
+            usable[a] = direction_min[a] > 0 || direction_max[a] < 0;
+            positive[a] = direction_min[a] > 0;
+            inv_min[a] = usable[a] ? 1 / direction_max[a] : 0;
+            inv_max[a] = usable[a] ? 1 / direction_min[a] : 0;
+        }
+    }
+
+    // false only if no ray of the bundle can hit the box closer than t_max
+    bool may_hit(const aabb& box, double t_max = infinity) const {
+        auto t_enter = -infinity;
+        auto t_exit = t_max;
+
+        for (int a = 0; a < 3; a += 1) {
+            if (!usable[a]) {
+                continue;
+            }
+
+            double near = positive[a] ? box.axis(a).min : box.axis(a).max;
+            double far = positive[a] ? box.axis(a).max : box.axis(a).min;
+
+            t_enter = fmax(t_enter, extreme(near, a, false));
+            t_exit = fmin(t_exit, extreme(far, a, true));
+        }
+
+        // the same allowance for rounding as aabb::hit, written so a nan never culls
+        t_exit *= 1 + 2 * rounding_error<real>(3);
+        return !(t_enter > t_exit || t_exit < 0);
+    }
+
+private:
+    point3 o_min, o_max;
+    vec3 inv_min, inv_max;
+    bool usable[3] = { false, false, false };
+    bool positive[3] = { false, false, false };
+
+    double extreme(double plane, int a, bool largest) const {
+        // (plane - o) * inv is bilinear, so its extremes over the bundle are at the corners
+        auto d0 = plane - o_min[a];
+        auto d1 = plane - o_max[a];
+        auto t0 = d0 * inv_min[a];
+        auto t1 = d0 * inv_max[a];
+        auto t2 = d1 * inv_min[a];
+        auto t3 = d1 * inv_max[a];
+        return largest ? fmax(fmax(t0, t1), fmax(t2, t3)) : fmin(fmin(t0, t1), fmin(t2, t3));
+    }
+};
+
+// Up to 64 coherent rays traced through the scene together, see hittable::hit_packet. Each lane
+// keeps its own closest hit, the active mask passed down the tree says which lanes are still
+// worth testing against a subtree.
+struct ray_packet {
+    static constexpr int max_rays = 64;
+
+    ray rays[max_rays];
+    hit_record recs[max_rays];
+    double closest[max_rays];
+    uint64_t lanes = 0; // lanes holding a ray
+    ray_bounds bounds;
+
+    // below this many rays hitting a node the packet has lost coherence, and the rays that are
+    // left finish the subtree on their own
+    int split_below = 4;
+
+    void clear() {
+        lanes = 0;
+    }
+
+    void set(int lane, const ray& r) {
+        rays[lane] = r;
+        closest[lane] = infinity;
+        lanes |= uint64_t(1) << lane;
+    }
+
+    // call once every ray is in, works out the bounds the whole packet is culled with
+    void close() {
+        point3 o_min(infinity, infinity, infinity);
+        point3 o_max(-infinity, -infinity, -infinity);
+        vec3 d_min(infinity, infinity, infinity);
+        vec3 d_max(-infinity, -infinity, -infinity);
+
+        for_each(lanes, [&](int lane) {
+            auto o = rays[lane].origin();
+            auto d = rays[lane].direction();
+            for (int a = 0; a < 3; a += 1) {
+                o_min[a] = fmin(o_min[a], o[a]);
+                o_max[a] = fmax(o_max[a], o[a]);
+                d_min[a] = fmin(d_min[a], d[a]);
+                d_max[a] = fmax(d_max[a], d[a]);
+            }
+        });
+
+        bounds = ray_bounds(o_min, o_max, d_min, d_max);
+    }
+
+    bool hit(int lane) const {
+        return closest[lane] < infinity;
+    }
+
+    // the furthest any active ray still needs to look
+    double farthest(uint64_t active) const {
+        double t = 0;
+        for_each(active, [&](int lane) { t = fmax(t, closest[lane]); });
+        return t;
+    }
+
+    // traces one lane against object on its own, keeping the hit if it is closer
+    void hit_single(int lane, const hittable& object) {
+        if (object.hit(rays[lane], interval(0, closest[lane]), recs[lane])) {
+            closest[lane] = recs[lane].t;
+        }
+    }
+
+    static int count(uint64_t mask) {
+        return static_cast<int>(std::bitset<max_rays>(mask).count());
+    }
+
+    template<typename F>
+    static void for_each(uint64_t mask, F&& fn) {
+        for (int lane = 0; mask != 0; lane += 1, mask >>= 1) {
+            if ((mask & 1) != 0) {
+                fn(lane);
+            }
+        }
+    }
+};
+
+#endif//__PACKET_H__
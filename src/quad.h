@@ -4,29 +4,78 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "arena.h"
+
+#include <algorithm>
 
 class quad : public hittable {
 public:
     quad(const point3& _Q, const vec3& _u, const vec3& _v, shared_ptr<material> m)
         : Q(_Q), u(_u), v(_v), mat(m)
     {
+        // worked out in double from the stored corner and edges
         auto n = cross(u, v);
         normal = unit_vector(n);
-        D = dot(normal, Q);
+        D = static_cast<real>(dot(normal, Q));
         w = n / dot(n, n);
 
         set_bounding_box();
     }
 
     virtual void set_bounding_box() {
-        bbox = aabb(Q, Q + u + v).pad();
+        // both diagonals, one alone misses the other corners of a skewed quad
+        bbox = aabb(aabb(Q, Q + u + v), aabb(Q + u, Q + v)).pad();
     }
 
     aabb bounding_box() const override {
         return bbox;
     }
 
+    bool clip_box(const aabb& region, aabb& clipped) const override {
+        // cut the corners down by each side of region in turn, then bound what is left
+        point3 corners[10] = { Q, Q + u, Q + u + v, Q + v };
+        point3 kept[10];
+        int count = 4;
+
+        for (int side = 0; side < 6 && count > 0; side += 1) {
+            auto a = side / 2;
+            auto upper = side % 2 == 1;
+            auto plane = upper ? region.axis(a).max : region.axis(a).min;
+            auto inside = [&](const point3& p) { return upper ? p[a] <= plane : p[a] >= plane; };
+
+            int kept_count = 0;
+            for (int i = 0; i < count; i += 1) {
+                const auto& p = corners[i];
+                const auto& q = corners[(i + 1) % count];
+                if (inside(p)) {
+                    kept[kept_count++] = p;
+                }
+                if (inside(p) != inside(q)) {
+                    auto crossing = p + (plane - p[a]) / (q[a] - p[a]) * (q - p);
+                    crossing[a] = plane;
+                    kept[kept_count++] = crossing;
+                }
+            }
+
+            std::copy(kept, kept + kept_count, corners);
+            count = kept_count;
+        }
+
+        clipped = aabb();
+        for (int i = 0; i < count; i += 1) {
+            // allow for the rounding of the crossings, then pad like the whole quad
+            auto error = vec3(1, 1, 1) * rounding_error(4) * max_abs_component(corners[i]);
+            clipped = aabb(clipped, aabb(corners[i] - error, corners[i] + error));
+        }
+        if (count > 0) {
+            clipped = overlap(clipped.pad(), region);
+        }
+        return true;
+    }
+
     bool hit(const ray&r, interval ray_t, hit_record& rec) const override {
+        STAT_INC(quad_tests);
+
         auto denom = dot(normal, r.direction());
 
         // no hit if ray is parallel to plane
@@ -50,8 +99,10 @@ public:
             return false;
         }
 
+        // project the hit back onto the plane, which bounds its error by its distance from the origin
         rec.t = t;
-        rec.p = intersection;
+        rec.p = intersection - (dot(normal, intersection) - D) * normal;
+        rec.p_error = rounding_error(7) * (max_abs_component(rec.p) + fabs(D));
         rec.mat = mat;
         rec.set_face_normal(r, normal);
 
@@ -74,17 +125,17 @@ public:
     void draw(const draw_options& options) const override;
 
 private:
-    point3 Q;
-    vec3 u, v;
+    point3r Q;
+    vec3r u, v;
     shared_ptr<material> mat;
     aabb bbox;
-    vec3 normal;
-    double D;
-    vec3 w;
+    vec3r normal;
+    real D;
+    vec3r w;
 };
 
-inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat) {
-    auto sides = make_shared<hittable_list>();
+inline shared_ptr<hittable_list> box(scene_arena& arena, const point3& a, const point3& b, shared_ptr<material> mat) {
+    auto sides = arena.make<hittable_list>();
 
     auto min = point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z()));
     auto max = point3(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()));
@@ -93,12 +144,12 @@ inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_pt
     auto dy = vec3(0, max.y() - min.y(), 0);
     auto dz = vec3(0, 0, max.z() - min.z());
 
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat)); // back
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat)); // left
-    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat)); // top
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat)); // bottom
+    sides->add(arena.make<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
+    sides->add(arena.make<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
+    sides->add(arena.make<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat)); // back
+    sides->add(arena.make<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat)); // left
+    sides->add(arena.make<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat)); // top
+    sides->add(arena.make<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat)); // bottom
 
     return sides;
 }
@@ -0,0 +1,605 @@
+#include "quantized_bvh.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/color.h>
+
+namespace {
+    constexpr int min_exponent = -126; // the smallest normal float, so the step is exact
+    constexpr int max_exponent = 127;
+
+    float step(int exponent) {
+        // 2^exponent, built from its bits rather than with a call to ldexpf
+        uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    float decode(float origin, int q, int exponent) {
+        // q * step is exact, so this rounds once, the same way every time
+        return origin + static_cast<float>(q) * step(exponent);
+    }
+
+    int quantize_down(double x, float origin, int exponent) {
+        auto q = std::floor((x - origin) / step(exponent));
+        auto lo = static_cast<int>(std::clamp(std::isnan(q) ? 0.0 : q, 0.0, 255.0));
+        while (lo > 0 && decode(origin, lo, exponent) > x) {
+            lo -= 1;
+        }
+        return lo;
+    }
+
+    int quantize_up(double x, float origin, int exponent) {
+        auto q = std::ceil((x - origin) / step(exponent));
+        auto hi = static_cast<int>(std::clamp(std::isnan(q) ? 255.0 : q, 0.0, 255.0));
+        while (hi < 255 && decode(origin, hi, exponent) < x) {
+            hi += 1;
+        }
+        return hi;
+    }
+
+    constexpr int split_bins = 16;
+    constexpr double min_overlap = 1e-5; // of the root's area, below it spatial splits aren't tried
+    constexpr int max_split_depth = 64; // deeper than this nodes are split at the median
+
+    double centre(const aabb& box, int a) {
+        return 0.5 * box.axis(a).min + 0.5 * box.axis(a).max;
+    }
+
+    int bin_of(double x, double lo, double extent) {
+        return std::clamp(static_cast<int>((x - lo) / extent * split_bins), 0, split_bins - 1);
+    }
+
+    // box cut down to [min, max] on axis a, rounded outwards
+    aabb slab(aabb box, int a, double min, double max) {
+        auto& bounds = a == 0 ? box.x : a == 1 ? box.y : box.z;
+        bounds = aabb::bounds(interval(fmax(bounds.min, min), fmin(bounds.max, max)));
+        return box;
+    }
+}
+
+struct quantized_bvh::split_build {
+    const std::vector<shared_ptr<hittable>>& objects;
+    size_t budget; // references spatial splits may still add
+    double min_overlap;
+    std::vector<uint32_t> slots; // the object of every reference, in leaf order
+    std::vector<aabb> boxes;
+
+    // the bins of a spatial split along a the reference spans, only the one its centre is in
+    // if the object can't be split
+    void span(const reference& r, int a, double lo, double extent, int& first, int& last) const {
+        first = bin_of(r.box.axis(a).min, lo, extent);
+        last = bin_of(r.box.axis(a).max, lo, extent);
+        aabb clipped;
+        if (first != last && !objects[r.object]->clip_box(r.box, clipped)) {
+            first = last = bin_of(centre(r.box, a), lo, extent);
+        }
+    }
+};
+
+quantized_bvh::quantized_bvh(const hittable_list& list, double split_budget) {
+    using namespace fmt;
+
+    static_assert(sizeof(node) == 36, "nodes should pack to 36 bytes");
+    static_assert(leaf_size <= 4, "leaf counts are stored in two bits");
+
+    const auto& objects = list.objects;
+    auto count = static_cast<uint32_t>(objects.size());
+    if (count == 0) {
+        return;
+    }
+
+    // below the root every leaf holds at least two references, so this is enough for a median
+    // split tree. the other grows as it needs to
+    nodes.reserve(count / 2 + 1);
+
+    if (split_budget > 0 && count > 1) {
+        std::vector<reference> refs(count);
+        for (uint32_t i = 0; i < count; i += 1) {
+            refs[i] = { objects[i]->bounding_box(), i };
+            dynamic = dynamic || objects[i]->animated();
+        }
+
+        aabb root;
+        for (const auto& r : refs) {
+            root = aabb(root, r.box);
+        }
+
+        split_build build{ objects, static_cast<size_t>(split_budget * count), min_overlap * root.area() };
+        std::vector<reference> sides[2];
+        split_refs(refs, build, 0, sides);
+        build.budget -= std::min(build.budget, sides[0].size() + sides[1].size() - count);
+        refs = std::vector<reference>();
+        build_split_node(sides, build, 0);
+
+        primitives.reserve(build.slots.size());
+        for (auto object : build.slots) {
+            primitives.push_back(objects[object]);
+        }
+        duplicate_count = primitives.size() - count;
+
+        leaf_boxes = std::move(build.boxes);
+        bbox = fit(nodes, 0, [this](uint32_t i) {
+            return leaf_boxes[i];
+        });
+        if (!dynamic) {
+            leaf_boxes = std::vector<aabb>();
+        }
+    } else {
+        primitives = objects;
+        build_median(count);
+    }
+
+    nodes.shrink_to_fit();
+    primitives.shrink_to_fit();
+
+    spdlog::debug("Built quantized bvh of {} objects with {} nodes and {} references added by spatial splits, {} per object", count,
+        nodes.size(), duplicate_count, format(fg(color::aqua), "{:.1f} bytes", static_cast<double>(bytes_used()) / count));
+}
+
+void quantized_bvh::build_median(uint32_t count) {
+    std::vector<uint32_t> order(count);
+    std::vector<point3r> centroids(count);
+    for (uint32_t i = 0; i < count; i += 1) {
+        auto box = primitives[i]->bounding_box();
+        order[i] = i;
+        centroids[i] = point3(
+            0.5 * box.x.min + 0.5 * box.x.max,
+            0.5 * box.y.min + 0.5 * box.y.max,
+            0.5 * box.z.min + 0.5 * box.z.max);
+        dynamic = dynamic || primitives[i]->animated();
+    }
+
+    build_node(order, centroids, 0, count);
+
+    // store the primitives in leaf order, so a leaf is a contiguous run of them
+    auto sorted = primitives;
+    for (uint32_t i = 0; i < count; i += 1) {
+        sorted[i] = primitives[order[i]];
+    }
+    primitives = std::move(sorted);
+
+    bbox = fit(nodes, 0, [this](uint32_t i) {
+        return primitives[i]->bounding_box();
+    });
+}
+
+uint32_t quantized_bvh::build_node(std::vector<uint32_t>& order, const std::vector<point3r>& centroids, uint32_t start, uint32_t end) {
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(node{});
+
+    if (end - start == 1) {
+        // a single object, only for a tree of one. both children are the same leaf
+        nodes[index].leaves = 3;
+        nodes[index].child[0] = nodes[index].child[1] = start;
+        return index;
+    }
+
+    // split at the median centroid along the widest axis
+    point3 min(infinity, infinity, infinity);
+    point3 max(-infinity, -infinity, -infinity);
+    for (auto i = start; i < end; i += 1) {
+        const auto& c = centroids[order[i]];
+        for (int a = 0; a < 3; a += 1) {
+            min[a] = fmin(min[a], c[a]);
+            max[a] = fmax(max[a], c[a]);
+        }
+    }
+
+    int axis = 0;
+    for (int a = 1; a < 3; a += 1) {
+        if (max[a] - min[a] > max[axis] - min[axis]) {
+            axis = a;
+        }
+    }
+
+    auto mid = start + (end - start) / 2;
+    std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&centroids, axis](uint32_t a, uint32_t b) {
+        return centroids[a][axis] < centroids[b][axis];
+    });
+
+    uint32_t ranges[2][2] = { { start, mid }, { mid, end } };
+    for (int c = 0; c < 2; c += 1) {
+        auto first = ranges[c][0];
+        auto span = ranges[c][1] - first;
+        if (span <= leaf_size) {
+            nodes[index].leaves |= static_cast<uint8_t>((1 << c) | ((span - 1) << (2 + 2 * c)));
+            nodes[index].child[c] = first;
+        } else {
+            auto child = build_node(order, centroids, first, ranges[c][1]);
+            nodes[index].child[c] = child;
+        }
+    }
+
+    return index;
+}
+
+double quantized_bvh::split_refs(std::vector<reference>& refs, split_build& build, int depth, std::vector<reference> sides[2]) const {
+    auto n = refs.size();
+    aabb bounds;
+    aabb centroids;
+    for (const auto& r : refs) {
+        bounds = aabb(bounds, r.box);
+        point3 c(centre(r.box, 0), centre(r.box, 1), centre(r.box, 2));
+        centroids = aabb(centroids, aabb(c, c));
+    }
+
+    // the split with the lowest surface area cost, an object split into bins by centre
+    auto best_cost = infinity;
+    auto best_overlap = 0.0;
+    int best_axis = -1;
+    int best_bin = 0;
+    bool spatial = false;
+
+    for (int a = 0; a < 3 && depth < max_split_depth; a += 1) {
+        double lo = centroids.axis(a).min;
+        double extent = centroids.axis(a).size();
+        if (!(extent > 0) || !std::isfinite(extent)) {
+            continue;
+        }
+
+        aabb bin_boxes[split_bins];
+        size_t counts[split_bins] = {};
+        for (const auto& r : refs) {
+            auto b = bin_of(centre(r.box, a), lo, extent);
+            counts[b] += 1;
+            bin_boxes[b] = aabb(bin_boxes[b], r.box);
+        }
+
+        aabb right_boxes[split_bins];
+        right_boxes[split_bins - 1] = bin_boxes[split_bins - 1];
+        for (int b = split_bins - 2; b >= 0; b -= 1) {
+            right_boxes[b] = aabb(bin_boxes[b], right_boxes[b + 1]);
+        }
+
+        aabb left;
+        size_t left_count = 0;
+        for (int b = 1; b < split_bins; b += 1) {
+            left = aabb(left, bin_boxes[b - 1]);
+            left_count += counts[b - 1];
+            auto right_count = n - left_count;
+            if (left_count == 0 || right_count == 0) {
+                continue;
+            }
+
+            auto cost = left.area() * left_count + right_boxes[b].area() * right_count;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_overlap = overlap(left, right_boxes[b]).area();
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+
+    // then a spatial split, if the object split leaves children that overlap. each side takes
+    // the part of the objects that cross the plane on its side
+    auto try_spatial = build.budget > 0 && depth < max_split_depth && (best_axis < 0 || best_overlap > build.min_overlap);
+    for (int a = 0; a < 3 && try_spatial; a += 1) {
+        double lo = bounds.axis(a).min;
+        double extent = bounds.axis(a).size();
+        if (!(extent > 0) || !std::isfinite(extent)) {
+            continue;
+        }
+
+        aabb bin_boxes[split_bins];
+        size_t entries[split_bins] = {};
+        size_t exits[split_bins] = {};
+        for (const auto& r : refs) {
+            int first, last;
+            build.span(r, a, lo, extent, first, last);
+            entries[first] += 1;
+            exits[last] += 1;
+
+            if (first == last) {
+                bin_boxes[first] = aabb(bin_boxes[first], r.box);
+                continue;
+            }
+
+            for (int b = first; b <= last; b += 1) {
+                auto region = slab(r.box, a, lo + extent * b / split_bins, lo + extent * (b + 1) / split_bins);
+                aabb clipped;
+                build.objects[r.object]->clip_box(region, clipped);
+                if (!clipped.empty()) {
+                    bin_boxes[b] = aabb(bin_boxes[b], clipped);
+                }
+            }
+        }
+
+        aabb right_boxes[split_bins];
+        size_t right_counts[split_bins];
+        right_boxes[split_bins - 1] = bin_boxes[split_bins - 1];
+        right_counts[split_bins - 1] = exits[split_bins - 1];
+        for (int b = split_bins - 2; b >= 0; b -= 1) {
+            right_boxes[b] = aabb(bin_boxes[b], right_boxes[b + 1]);
+            right_counts[b] = exits[b] + right_counts[b + 1];
+        }
+
+        aabb left;
+        size_t left_count = 0;
+        for (int b = 1; b < split_bins; b += 1) {
+            left = aabb(left, bin_boxes[b - 1]);
+            left_count += entries[b - 1];
+            auto right_count = right_counts[b];
+
+            // a side may keep every reference, cut down to a smaller box. the budget and the
+            // depth limit stop that going on for ever
+            if (left_count == 0 || right_count == 0 || left_count + right_count - n > build.budget) {
+                continue;
+            }
+
+            auto cost = left.area() * left_count + right_boxes[b].area() * right_count;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = b;
+                spatial = true;
+            }
+        }
+    }
+
+    if (spatial) {
+        double lo = bounds.axis(best_axis).min;
+        double extent = bounds.axis(best_axis).size();
+        auto plane = lo + extent * best_bin / split_bins;
+
+        for (const auto& r : refs) {
+            int first, last;
+            build.span(r, best_axis, lo, extent, first, last);
+            if (last < best_bin) {
+                sides[0].push_back(r);
+            } else if (first >= best_bin) {
+                sides[1].push_back(r);
+            } else {
+                aabb clipped;
+                build.objects[r.object]->clip_box(slab(r.box, best_axis, -infinity, plane), clipped);
+                if (!clipped.empty()) {
+                    sides[0].push_back({ clipped, r.object });
+                }
+                build.objects[r.object]->clip_box(slab(r.box, best_axis, plane, infinity), clipped);
+                if (!clipped.empty()) {
+                    sides[1].push_back({ clipped, r.object });
+                }
+            }
+        }
+    } else if (best_axis >= 0) {
+        double lo = centroids.axis(best_axis).min;
+        double extent = centroids.axis(best_axis).size();
+        for (const auto& r : refs) {
+            sides[bin_of(centre(r.box, best_axis), lo, extent) < best_bin ? 0 : 1].push_back(r);
+        }
+    }
+
+    if (sides[0].empty() || sides[1].empty()) {
+        // no split found, or clipping left a side empty. halve at the median centre instead
+        int axis = 0;
+        for (int a = 1; a < 3; a += 1) {
+            if (centroids.axis(a).size() > centroids.axis(axis).size()) {
+                axis = a;
+            }
+        }
+
+        auto mid = refs.begin() + n / 2;
+        std::nth_element(refs.begin(), mid, refs.end(), [axis](const reference& a, const reference& b) {
+            return centre(a.box, axis) < centre(b.box, axis);
+        });
+        sides[0].assign(refs.begin(), mid);
+        sides[1].assign(mid, refs.end());
+    }
+
+    double cost = 0;
+    for (int c = 0; c < 2; c += 1) {
+        aabb box;
+        for (const auto& r : sides[c]) {
+            box = aabb(box, r.box);
+        }
+        cost += box.area() * sides[c].size();
+    }
+    return cost;
+}
+
+uint32_t quantized_bvh::build_split_node(std::vector<reference> sides[2], split_build& build, int depth) {
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(node{});
+
+    for (int c = 0; c < 2; c += 1) {
+        auto& refs = sides[c];
+        auto count = static_cast<uint32_t>(refs.size());
+
+        // a small enough set of references becomes a leaf unless splitting it is cheaper. a
+        // node costs about as much to step into as an object does to test
+        std::vector<reference> split[2];
+        auto leaf = count == 1;
+        if (!leaf) {
+            aabb bounds;
+            for (const auto& r : refs) {
+                bounds = aabb(bounds, r.box);
+            }
+            auto split_cost = bounds.area() + split_refs(refs, build, depth + 1, split);
+            leaf = count <= leaf_size && bounds.area() * count <= split_cost;
+        }
+
+        if (leaf) {
+            nodes[index].leaves |= static_cast<uint8_t>((1 << c) | ((count - 1) << (2 + 2 * c)));
+            nodes[index].child[c] = static_cast<uint32_t>(build.slots.size());
+            for (const auto& r : refs) {
+                build.slots.push_back(r.object);
+                build.boxes.push_back(r.box);
+            }
+            continue;
+        }
+
+        // only a split that is used spends the budget
+        build.budget -= std::min(build.budget, split[0].size() + split[1].size() - count);
+        refs = std::vector<reference>();
+
+        auto child = build_split_node(split, build, depth + 1);
+        nodes[index].child[c] = child;
+    }
+
+    return index;
+}
+
+template<typename F>
+aabb quantized_bvh::fit(std::vector<node>& out, uint32_t index, F&& box_of) const {
+    auto& n = out[index];
+
+    aabb boxes[2];
+    for (int c = 0; c < 2; c += 1) {
+        if (c == 1 && n.is_leaf(0) && n.is_leaf(1) && n.child[0] == n.child[1]) {
+            boxes[1] = boxes[0];
+        } else if (n.is_leaf(c)) {
+            for (auto i = n.child[c]; i < n.child[c] + n.leaf_count(c); i += 1) {
+                boxes[c] = aabb(boxes[c], box_of(i));
+            }
+        } else {
+            boxes[c] = fit(out, n.child[c], box_of);
+        }
+    }
+
+    quantize(n, boxes);
+    return aabb(boxes[0], boxes[1]);
+}
+
+void quantized_bvh::quantize(node& n, const aabb boxes[2]) {
+    const auto largest = std::numeric_limits<float>::max();
+
+    for (int a = 0; a < 3; a += 1) {
+        double lo = fmin(boxes[0].axis(a).min, boxes[1].axis(a).min);
+        double hi = fmax(boxes[0].axis(a).max, boxes[1].axis(a).max);
+
+        // the frame starts at or below the lowest bound, and the smallest step that reaches
+        // the highest in 255 of them. an infinite bound runs out to the largest float
+        auto origin = std::clamp(round_down<float>(lo), -largest, largest);
+        int exponent = min_exponent;
+        auto extent = hi - origin;
+        if (extent > 0 && std::isfinite(extent)) {
+            exponent = std::clamp(static_cast<int>(std::ceil(std::log2(extent / 255))), min_exponent, max_exponent);
+        } else if (extent > 0) {
+            exponent = max_exponent;
+        }
+        while (exponent < max_exponent && decode(origin, 255, exponent) < hi) {
+            exponent += 1;
+        }
+
+        n.origin[a] = origin;
+        n.exponent[a] = static_cast<int8_t>(exponent);
+        for (int c = 0; c < 2; c += 1) {
+            n.lo[c][a] = static_cast<uint8_t>(quantize_down(boxes[c].axis(a).min, origin, exponent));
+            n.hi[c][a] = static_cast<uint8_t>(quantize_up(boxes[c].axis(a).max, origin, exponent));
+        }
+    }
+}
+
+aabb quantized_bvh::node::child_box(int c) const {
+    return aabb(
+        aabb::bounds(decode(origin[0], lo[c][0], exponent[0]), decode(origin[0], hi[c][0], exponent[0])),
+        aabb::bounds(decode(origin[1], lo[c][1], exponent[1]), decode(origin[1], hi[c][1], exponent[1])),
+        aabb::bounds(decode(origin[2], lo[c][2], exponent[2]), decode(origin[2], hi[c][2], exponent[2])));
+}
+
+size_t quantized_bvh::bytes_used() const {
+    return (nodes.capacity() + next_nodes.capacity()) * sizeof(node)
+        + primitives.capacity() * sizeof(shared_ptr<hittable>)
+        + leaf_boxes.capacity() * sizeof(aabb);
+}
+
+bool quantized_bvh::hit(const ray& r, interval ray_t, hit_record& rec) const {
+    if (nodes.empty() || !bbox.hit(r, ray_t)) {
+        return false;
+    }
+
+    bool hit_anything = false;
+    auto closest = ray_t.max;
+
+    // deep enough for max_split_depth levels of spatial splits and median splits below them
+    uint32_t stack[128];
+    int top = 0;
+    stack[top++] = 0;
+
+    // a split object is in more than one leaf, often neighbouring ones. testing it again would
+    // find the same hit, so the last few objects tested are skipped
+    const hittable* tested[4] = {};
+    int next_tested = 0;
+
+    while (top > 0) {
+        const auto& n = nodes[stack[--top]];
+        STAT_INC(bvh_nodes_visited);
+
+        uint32_t next[2];
+        int pushed = 0;
+
+        for (int c = 0; c < 2; c += 1) {
+            if (c == 1 && n.is_leaf(0) && n.is_leaf(1) && n.child[0] == n.child[1]) {
+                break;
+            }
+
+            if (!n.child_box(c).hit(r, interval(ray_t.min, closest))) {
+                continue;
+            }
+
+            if (!n.is_leaf(c)) {
+                next[pushed++] = n.child[c];
+                continue;
+            }
+
+            for (auto i = n.child[c]; i < n.child[c] + n.leaf_count(c); i += 1) {
+                const auto* object = primitives[i].get();
+                if (duplicate_count > 0) {
+                    if (std::find(std::begin(tested), std::end(tested), object) != std::end(tested)) {
+                        continue;
+                    }
+                    tested[next_tested++ % 4] = object;
+                }
+
+                if (object->hit(r, interval(ray_t.min, closest), rec)) {
+                    hit_anything = true;
+                    closest = rec.t;
+                }
+            }
+        }
+
+        // the left child comes off the stack first, as bvh_node visits it
+        while (pushed > 0) {
+            stack[top++] = next[--pushed];
+        }
+    }
+
+    return hit_anything;
+}
+
+aabb quantized_bvh::prepare_frame(double time) {
+    if (!dynamic) {
+        return bbox;
+    }
+
+    // every frame is worked out again, not only those above an animated object, as the nodes
+    // have no room to say which those are
+    next_nodes = nodes;
+    next_bbox = fit(next_nodes, 0, [this, time](uint32_t i) {
+        if (primitives[i]->animated()) {
+            return primitives[i]->prepare_frame(time);
+        }
+        return leaf_boxes.empty() ? primitives[i]->bounding_box() : leaf_boxes[i];
+    });
+    return next_bbox;
+}
+
+void quantized_bvh::commit_frame() {
+    if (!dynamic) {
+        return;
+    }
+
+    for (const auto& object : primitives) {
+        if (object->animated()) {
+            object->commit_frame();
+        }
+    }
+    std::swap(nodes, next_nodes);
+    bbox = next_bbox;
+}
@@ -0,0 +1,110 @@
+#ifndef __QUANTIZED_BVH_H__
+#define __QUANTIZED_BVH_H__
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "aabb.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A bvh stored as one flat array of small nodes, for scenes too big for bvh_node, which costs
+// a heap object of over 100 bytes per node. Each node keeps a frame, an origin and a power of
+// two step per axis, and the bounds of both its children as 8-bit multiples of that step, 36
+// bytes for the pair. The quantized bounds are rounded outwards and checked against the float
+// arithmetic they are decoded with, so a decoded box always covers the child and the usual
+// conservative slab test on it never misses a hit.
+//
+// Objects with infinite bounds are covered as far as the largest float in every direction.
+//
+// By default nodes split their objects in half at the median. With a split budget the tree is
+// built with the surface area heuristic instead, and where the children of an object split
+// would overlap, a spatial split may cut large objects in two along a plane, see clip_box, so
+// each side only references the part of them it needs. That adds references, up to the budget
+// times the number of objects. A split object is tested again in every leaf it is in, which
+// finds the same hit, so traversal only skips the ones it has just tested.
+class quantized_bvh : public hittable {
+public:
+    static constexpr int leaf_size = 4;
+
+    quantized_bvh(const hittable_list& list, double split_budget = 0);
+
+    // objects, counting every reference to a split one
+    size_t size() const {
+        return primitives.size();
+    }
+
+    size_t duplicates() const {
+        return duplicate_count;
+    }
+
+    // memory used by the nodes and the references, excluding the objects themselves
+    size_t bytes_used() const;
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    void draw(const draw_options& options) const override;
+
+    bool animated() const override {
+        return dynamic;
+    }
+
+    // Moving objects are refitted like bvh_node: the shape stays and the frames and bounds are
+    // worked out again, into a second copy of the nodes so the current one can still be traced
+    aabb prepare_frame(double time) override;
+    void commit_frame() override;
+
+private:
+    struct node {
+        float origin[3];
+        int8_t exponent[3]; // the step of each axis is 2^exponent
+        uint8_t leaves; // bit c set when child c is a leaf, bits 2 + 2c on are its count less one
+        uint8_t lo[2][3];
+        uint8_t hi[2][3];
+        uint32_t child[2]; // the node, or the first primitive of a leaf
+
+        bool is_leaf(int c) const {
+            return (leaves >> c) & 1;
+        }
+
+        uint32_t leaf_count(int c) const {
+            return ((leaves >> (2 + 2 * c)) & 3) + 1;
+        }
+
+        aabb child_box(int c) const;
+    };
+
+    struct reference {
+        aabb box; // the part of the object this reference covers
+        uint32_t object;
+    };
+
+    struct split_build;
+
+    std::vector<shared_ptr<hittable>> primitives; // in leaf order
+    std::vector<aabb> leaf_boxes; // bounds of every reference, only kept to refit a split tree
+    size_t duplicate_count = 0;
+    std::vector<node> nodes;
+    std::vector<node> next_nodes; // written by prepare_frame
+    aabb bbox;
+    aabb next_bbox;
+    bool dynamic = false;
+
+    void build_median(uint32_t count);
+    uint32_t build_node(std::vector<uint32_t>& order, const std::vector<point3r>& centroids, uint32_t start, uint32_t end);
+    double split_refs(std::vector<reference>& refs, split_build& build, int depth, std::vector<reference> sides[2]) const;
+    uint32_t build_split_node(std::vector<reference> sides[2], split_build& build, int depth);
+
+    // works out the bounds of the subtree from box_of each primitive, writing its frames to out
+    template<typename F>
+    aabb fit(std::vector<node>& out, uint32_t index, F&& box_of) const;
+
+    static void quantize(node& n, const aabb boxes[2]);
+};
+
+#endif//__QUANTIZED_BVH_H__
@@ -3,14 +3,20 @@
 
 #include "vec3.h"
 
+#include <algorithm>
+
 class ray {
 public:
     ray() {}
-    ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction), tm(0){}
+    ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction), tm(0) {
+        prepare_traversal();
+    }
 
     ray(const point3& origin, const vec3& direction, double time = 0.0)
         : orig(origin), dir(direction), tm(time)
-    {}
+    {
+        prepare_traversal();
+    }
 
     inline point3 origin() const { return orig; }
     inline vec3 direction() const { return dir; }
@@ -20,10 +26,30 @@ public:
         return orig + t * dir;
     }
 
+    // the origin and reciprocal direction bounding boxes are tested with, worked out once per
+    // ray instead of once per box, and how far rounding to real moved the origin on any axis
+    inline const point3r& traversal_origin() const { return trav_orig; }
+    inline const vec3r& inv_direction() const { return inv_dir; }
+    inline real origin_error() const { return orig_error; }
+
 private:
     point3 orig;
     vec3 dir;
     double tm;
+
+    point3r trav_orig;
+    vec3r inv_dir;
+    real orig_error;
+
+    void prepare_traversal() {
+        trav_orig = orig;
+        inv_dir = vec3(1 / dir[0], 1 / dir[1], 1 / dir[2]);
+
+        orig_error = 0;
+        for (int a = 0; a < 3; a += 1) {
+            orig_error = std::max(orig_error, round_up<real>(fabs(orig[a] - trav_orig[a])));
+        }
+    }
 };
 
 #endif//__RAY_H__
@@ -1,11 +1,15 @@
 #include "rtweekend.h"
+#include "animation.h"
+#include "box.h"
 #include "bvh.h"
 #include "constant_medium.h"
 #include "hittable.h"
 #include "material.h"
 #include "quad.h"
+#include "quantized_bvh.h"
 #include "ray.h"
 #include "sphere.h"
+#include "sphere_set.h"
 #include "vec3.h"
 #include "raylib_window.h"
 
@@ -37,6 +41,23 @@ void bvh_node::draw(const draw_options& options) const {
     }
 }
 
+void quantized_bvh::draw(const draw_options& options) const {
+    for (const auto& object : primitives) {
+        object->draw(options);
+    }
+
+    if (options.enable_debug) {
+        for (const auto& n : nodes) {
+            for (int c = 0; c < 2; c += 1) {
+                auto box = n.child_box(c);
+                Vector3 size { static_cast<float>(box.x.size()), static_cast<float>(box.y.size()), static_cast<float>(box.z.size()) };
+                Vector3 ctr { static_cast<float>(box.x.min) + size.x / 2, static_cast<float>(box.y.min) + size.y / 2, static_cast<float>(box.z.min) + size.z / 2 };
+                DrawCubeWiresV(ctr, size, RAYWHITE);
+            }
+        }
+    }
+}
+
 void quad::draw(const draw_options& options) const {
     auto mat_col = mat->get_colour();
 
@@ -62,6 +83,33 @@ void quad::draw(const draw_options& options) const {
     DrawTriangleStrip3D(points, 4, col);
 }
 
+void box_primitive::draw(const draw_options& options) const {
+    auto c = mat->get_colour();
+    Color col {
+        static_cast<uint8_t>(c.x() * 255.999),
+        static_cast<uint8_t>(c.y() * 255.999),
+        static_cast<uint8_t>(c.z() * 255.999),
+        255,
+    };
+
+    auto size = hi - lo;
+    auto ctr = lo + size / 2;
+
+    rlPushMatrix();
+    rlTranslatef(
+        static_cast<float>(offset.x()),
+        static_cast<float>(offset.y()),
+        static_cast<float>(offset.z())
+    );
+    rlRotatef(angle, 0, 1, 0);
+    DrawCubeV(
+        Vector3 { static_cast<float>(ctr.x()), static_cast<float>(ctr.y()), static_cast<float>(ctr.z()) },
+        Vector3 { static_cast<float>(size.x()), static_cast<float>(size.y()), static_cast<float>(size.z()) },
+        col
+    );
+    rlPopMatrix();
+}
+
 void sphere::draw(const draw_options& options) const {
     Vector3 ctr {
         static_cast<float>(center1.x()),
@@ -105,6 +153,32 @@ void sphere::draw(const draw_options& options) const {
     }
 }
 
+void sphere_set::draw(const draw_options& options) const {
+    for (size_t i = 0; i < size(); i += 1) {
+        auto c = materials[material_ids[i]]->get_colour();
+        Color col {
+            static_cast<uint8_t>(c.x() * 255.999),
+            static_cast<uint8_t>(c.y() * 255.999),
+            static_cast<uint8_t>(c.z() * 255.999),
+            255,
+        };
+
+        DrawSphereEx(Vector3{ cx[i], cy[i], cz[i] }, radii[i], 6, 6, col);
+    }
+
+    if (options.enable_debug) {
+        for (const auto& n : nodes) {
+            if (n.count == 0) {
+                continue;
+            }
+
+            Vector3 size { n.max[0] - n.min[0], n.max[1] - n.min[1], n.max[2] - n.min[2] };
+            Vector3 ctr { n.min[0] + size.x / 2, n.min[1] + size.y / 2, n.min[2] + size.z / 2 };
+            DrawCubeWiresV(ctr, size, MAROON);
+        }
+    }
+}
+
 void constant_medium::draw(const draw_options& options) const {
     boundary->draw(options);
 }
@@ -126,3 +200,15 @@ void rotate_y::draw(const draw_options& options) const {
     object->draw(options);
     rlPopMatrix();
 }
+
+void animated_instance::draw(const draw_options& options) const {
+    rlPushMatrix();
+    rlTranslatef(
+        static_cast<float>(current.offset.x()),
+        static_cast<float>(current.offset.y()),
+        static_cast<float>(current.offset.z())
+    );
+    rlRotatef(current.angle, 0, 1, 0);
+    object->draw(options);
+    rlPopMatrix();
+}
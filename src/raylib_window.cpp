@@ -1,21 +1,59 @@
 #include "raylib_window.h"
+#include "trace_observer.h"
 
+#include <mutex>
 #include <raylib.h>
 #include <raygui.h>
 
 namespace {
+    // everything a render run reads from the ui, copied when the render is requested
+    struct render_settings {
+        Camera3D view;
+        int scale = 1;
+        int samples = 1;
+        int max_depth = 1;
+        render_mode mode = render_mode::beauty;
+        bool reuse_samples = false;
+        bool clear = false;
+    };
+
     tf::Taskflow taskflow;
     tf::Future<void> future;
 
+    // restarts don't wait for the previous run to drain, the executor queues the new run behind
+    // it. settings are handed over under a lock together with the generation they belong to
+    std::mutex settings_mutex;
+    render_settings next_render;
+    uint64_t next_generation = 0;
+    uint64_t last_run_generation = 0; // only touched by runs, which never overlap
+
+    async_image_writer* image_writer = nullptr;
+    std::string save_file;
+
     Camera3D cam3d;
+    Camera3D render_cam3d; // copy of cam3d taken when a render is started
     Texture2D renderedTexture;
 
     float samples;
     float max_depth;
+    int render_mode_index;
+
+    // interactive preview renders at each of these fractions of the resolution in turn, then
+    // refines to full quality once the camera has been still for refine_delay seconds
+    const int preview_scales[] = { 8, 4, 2 };
+    const int num_preview_stages = sizeof(preview_scales) / sizeof(preview_scales[0]);
+    const int preview_max_depth = 4;
+    const double refine_delay = 0.3;
+
+    bool interactive = false;
+    int preview_stage = -1; // stage being rendered, num_preview_stages means full quality
+    int render_scale = 1;
+    double last_motion_time = 0;
 
     bool show_panel = true;
     bool enable_move = false;
     bool enable_debug = false;
+    bool reuse_samples = false;
 }
 
 static void set_logging_level(const std::string& level) {
@@ -56,29 +94,93 @@ inline Color toRaylibColor(const pixel& px) {
     return Color{ px.r, px.g, px.b, px.a };
 }
 
+inline bool same_view(const Camera3D& a, const Camera3D& b) {
+    auto same = [](const Vector3& p, const Vector3& q) {
+        return p.x == q.x && p.y == q.y && p.z == q.z;
+    };
+    return same(a.position, b.position) && same(a.target, b.target) && same(a.up, b.up) && a.fovy == b.fovy;
+}
+
+inline bool render_finished() {
+    return !future.valid() || future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+inline void start_render(tf::Executor &executor, camera &cam, int scale, bool clear = false) {
+    render_scale = scale;
+    render_cam3d = cam3d;
+
+    {
+        std::lock_guard<std::mutex> lock(settings_mutex);
+        next_render = render_settings{ cam3d, scale, (int)samples, (int)max_depth, static_cast<render_mode>(render_mode_index), reuse_samples, clear };
+        next_generation = cam.cancel();
+    }
+
+    future = executor.run(taskflow);
+}
+
+inline void update_preview(tf::Executor &executor, camera &cam) {
+    auto now = GetTime();
+
+    if (!same_view(cam3d, render_cam3d)) {
+        last_motion_time = now;
+        preview_stage = 0;
+        start_render(executor, cam, preview_scales[preview_stage]);
+        return;
+    }
+
+    if (preview_stage >= num_preview_stages || !render_finished()) {
+        return;
+    }
+
+    if (preview_stage + 1 < num_preview_stages) {
+        preview_stage += 1;
+        start_render(executor, cam, preview_scales[preview_stage]);
+    } else if (now - last_motion_time >= refine_delay) {
+        preview_stage = num_preview_stages;
+        start_render(executor, cam, 1);
+    }
+}
+
 inline bool update(tf::Executor &executor, camera &cam, const hittable_list& world, std::shared_ptr<bitmap> bmp) {
     if (IsKeyPressed(KEY_SPACE)) {
         show_panel = !show_panel;
-        enable_move = !show_panel && !cam.rendering();
+        enable_move = !show_panel && (interactive || !cam.rendering());
     }
 
-    if (!cam.rendering() && enable_move) {
+    if ((interactive || !cam.rendering()) && enable_move) {
         UpdateCamera(&cam3d, CAMERA_FIRST_PERSON);
     }
 
-    UpdateTexture(renderedTexture, bmp->data);
+    if (interactive) {
+        update_preview(executor, cam);
+    }
+
+    // only upload tiles the workers have finished since the last frame, the bitmap itself is
+    // still being written to so it is never read here while a render is running. tiles from
+    // cancelled renders can still arrive, those would paint over a newer view
+    auto generation = cam.current_generation();
+    cam.drain_tiles([generation](tile_update&& tile) {
+        if (tile.generation != generation) {
+            return;
+        }
+
+        Rectangle rec{
+            static_cast<float>(tile.area.x1),
+            static_cast<float>(tile.area.y1),
+            static_cast<float>(tile.area.x2 - tile.area.x1),
+            static_cast<float>(tile.area.y2 - tile.area.y1),
+        };
+        UpdateTextureRec(renderedTexture, rec, tile.pixels.data());
+    });
 
     return false;
 }
 
 inline void draw(tf::Executor &executor, camera &cam, const hittable_list& world, std::shared_ptr<bitmap> bmp) {
-    auto restart_render = [&, bmp]() {
-        bmp->clear();
-        cam.cancel();
-        if (future.valid()) {
-            future.wait();
-        }
-        future = executor.run(taskflow);
+    auto restart_render = [&]() {
+        // when samples are reused the old image stays up until the reprojected tiles replace it
+        preview_stage = num_preview_stages;
+        start_render(executor, cam, 1, !reuse_samples);
     };
 
     float screen_width = GetScreenWidth();
@@ -105,6 +207,9 @@ inline void draw(tf::Executor &executor, camera &cam, const hittable_list& world
     } else if (cam.complete()) {
         status_text = "Done";
     }
+    if (interactive && preview_stage < num_preview_stages) {
+        status_text = TextFormat("Preview 1/%d", render_scale);
+    }
 
     int margin = 10;
     int status_bar_height = 20;
@@ -122,6 +227,14 @@ inline void draw(tf::Executor &executor, camera &cam, const hittable_list& world
         int item_y = panel_y + padding;
         int max_item_width = panel_width - padding - padding;
 
+        // stays usable while rendering, turning it on starts a new preview
+        bool was_interactive = interactive;
+        GuiCheckBox(Rectangle{ static_cast<float>(item_x), static_cast<float>(item_y), 16, 16 }, "Interactive Preview", &interactive);
+        if (interactive && !was_interactive) {
+            preview_stage = -1;
+        }
+        item_y += 20 + 16;
+
         if (cam.rendering() && !cam.complete()) {
             GuiLock();
             GuiSetState(STATE_DISABLED);
@@ -129,6 +242,8 @@ inline void draw(tf::Executor &executor, camera &cam, const hittable_list& world
 
         GuiCheckBox(Rectangle{ static_cast<float>(item_x), static_cast<float>(item_y), 16, 16 }, "Enable Debug Drawing", &enable_debug);
         item_y += 20 + 16;
+        GuiCheckBox(Rectangle{ static_cast<float>(item_x), static_cast<float>(item_y), 16, 16 }, "Reuse Samples", &reuse_samples);
+        item_y += 20 + 16;
 
         DrawText(TextFormat("Samples: %d", (int)samples), item_x, item_y, 10, BLACK);
         item_y += 10 + 8;
@@ -137,15 +252,53 @@ inline void draw(tf::Executor &executor, camera &cam, const hittable_list& world
         DrawText(TextFormat("Max Depth: %d", (int)max_depth), item_x, item_y, 10, BLACK);
         item_y += 10 + 8;
         GuiSlider({ (float)item_x + 16, (float)item_y, (float)max_item_width - 32, 20 }, "1", "80", (float*)&max_depth, 1, 80);
+        item_y += 20 + 16;
+        DrawText("Render Mode:", item_x, item_y, 10, BLACK);
+        item_y += 10 + 8;
+        GuiComboBox({ (float)item_x + 16, (float)item_y, (float)max_item_width - 32, 20 }, "Beauty;BVH Nodes;Primitives;Cycles", &render_mode_index);
 
         GuiSetState(STATE_NORMAL);
         GuiUnlock();
 
+#if ACE_ENABLE_STATS
+        if (cam.complete()) {
+            auto stats = cam.statistics();
+            auto stat_line = [&](const char* text) {
+                DrawText(text, item_x, item_y, 10, BLACK);
+                item_y += 10 + 4;
+            };
+
+            item_y += 20 + 16;
+            stat_line("Statistics:");
+            stat_line(TextFormat("  Camera rays: %llu", (unsigned long long)stats.camera_rays));
+            stat_line(TextFormat("  Bounce rays: %llu", (unsigned long long)stats.bounce_rays));
+            stat_line(TextFormat("  BVH nodes visited: %llu", (unsigned long long)stats.bvh_nodes_visited));
+            stat_line(TextFormat("  AABB tests: %llu", (unsigned long long)stats.aabb_tests));
+            stat_line(TextFormat("  Sphere tests: %llu", (unsigned long long)stats.sphere_tests));
+            stat_line(TextFormat("  Quad tests: %llu", (unsigned long long)stats.quad_tests));
+            stat_line(TextFormat("  Box tests: %llu", (unsigned long long)stats.box_tests));
+            stat_line(TextFormat("  Medium tests: %llu", (unsigned long long)stats.medium_tests));
+            stat_line(TextFormat("  Instance tests: %llu", (unsigned long long)stats.instance_tests));
+            stat_line(TextFormat("  Packets: %llu", (unsigned long long)stats.packets));
+            stat_line(TextFormat("  Path depth: %.2f avg, %llu max", stats.average_path_depth(), (unsigned long long)stats.max_path_depth));
+        }
+#endif
+
+        // encoding happens on the executor so the window keeps drawing while the file is written
+        if (!cam.complete()) {
+            GuiSetState(STATE_DISABLED);
+        }
+        if (GuiButton({ (float)panel_x + padding, (float)panel_height - 32 - 40, (float)panel_width - 32, 32 }, "Save Image") && cam.complete()) {
+            image_writer->submit(save_file, cam.capture_image(*bmp));
+        }
+        GuiSetState(STATE_NORMAL);
+
         if (GuiButton({ (float)panel_x + padding, (float)panel_height - 32, (float)panel_width - 32, 32 }, button_text)) {
             spdlog::trace("Render clicked!");
 
             if (cam.rendering() && !cam.complete()) {
                 cam.cancel();
+                preview_stage = num_preview_stages;
             } else {
                 restart_render();
             }
@@ -171,16 +324,49 @@ void raylib_window::run(camera& cam, const hittable_list& world, std::shared_ptr
     set_logging_level(log_level);
 
     tf::Executor executor(num_threads);
+    if (trace::enabled()) {
+        executor.make_observer<trace_observer>();
+    }
 
     taskflow.emplace([&world, &cam, bmp](tf::Subflow subflow) {
-        cam.lookat = fromRaylibVector3(cam3d.target);
-        cam.lookfrom = fromRaylibVector3(cam3d.position);
-        cam.vup = fromRaylibVector3(cam3d.up);
-        cam.vfov = cam3d.fovy;
-        cam.samples_per_pixel = (int)samples;
-        cam.max_depth = (int)max_depth;
+        render_settings settings;
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(settings_mutex);
+            settings = next_render;
+            generation = next_generation;
+        }
+
+        // several runs can be queued up by quick restarts, only the first to start after the
+        // latest one has anything to do. the camera also drops the render if it is already stale
+        if (generation == last_run_generation) {
+            return;
+        }
+        last_run_generation = generation;
+
+        cam.lookat = fromRaylibVector3(settings.view.target);
+        cam.lookfrom = fromRaylibVector3(settings.view.position);
+        cam.vup = fromRaylibVector3(settings.view.up);
+        cam.vfov = settings.view.fovy;
+        cam.preview_scale = settings.scale;
+        cam.reuse_samples = settings.reuse_samples;
+        if (settings.scale > 1) {
+            cam.samples_per_pixel = 1;
+            cam.max_depth = std::min(settings.max_depth, preview_max_depth);
+            cam.mode = render_mode::beauty;
+        } else {
+            cam.samples_per_pixel = settings.samples;
+            cam.max_depth = settings.max_depth;
+            cam.mode = settings.mode;
+        }
         cam.init();
-        cam.render(world, subflow, bmp);
+
+        if (settings.clear) {
+            bmp->clear();
+            cam.publish_image(*bmp, generation);
+        }
+
+        cam.render(world, subflow, bmp, generation);
     });
 
     dimensions dims = cam.get_image_dimensions();
@@ -198,6 +384,21 @@ void raylib_window::run(camera& cam, const hittable_list& world, std::shared_ptr
 
     samples = cam.samples_per_pixel;
     max_depth = cam.max_depth;
+    render_mode_index = static_cast<int>(cam.mode);
+
+    async_image_writer writer(executor);
+    image_writer = &writer;
+    ::save_file = save_file;
+
+    render_cam3d = cam3d;
+    interactive = start_interactive;
+    reuse_samples = cam.reuse_samples;
+    cam.publish_tiles = true;
+
+    if (render_on_start) {
+        preview_stage = num_preview_stages;
+        start_render(executor, cam, 1);
+    }
 
     SetTargetFPS(60);
 
@@ -208,9 +409,10 @@ void raylib_window::run(camera& cam, const hittable_list& world, std::shared_ptr
         draw(executor, cam, world, bmp);
     }
 
+    // the last run has to finish before the world and bitmap go away
     cam.cancel();
-    if (future.valid()) {
-        future.wait();
-    }
+    executor.wait_for_all();
+    writer.wait();
+    image_writer = nullptr;
     CloseWindow();
 }
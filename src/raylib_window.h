@@ -5,14 +5,20 @@
 #include "hittable.h"
 #include "hittable_list.h"
 #include "bitmap.h"
+#include "trace.h"
+#include "image_writer.h"
 
 #include <memory>
+#include <string>
 #include <thread>
 
 class raylib_window {
 public:
     int num_threads = std::thread::hardware_concurrency();
     std::string log_level = "info";
+    bool render_on_start = false;
+    bool start_interactive = false; // begin with the progressive preview enabled
+    std::string save_file = "render.png"; // written by the Save Image button, format from the extension
 
     void run(camera& cam, const hittable_list& world, std::shared_ptr<bitmap> bmp);
 };
@@ -1,6 +1,8 @@
 #ifndef __RTW_IMAGE_H__
 #define __RTW_IMAGE_H__
 
+#include "trace.h"
+
 #include <stb_image.h>
 #include <spdlog/spdlog.h>
 #include <cstdlib>
@@ -12,6 +14,8 @@ public:
     rtw_image() : data(nullptr) {}
 
     rtw_image(const char* image_filename) {
+        trace_zone zone("texture load", "scene");
+        zone.arg("file", image_filename);
 
         auto filename = std::string(image_filename);
         auto imagedir = getenv("RTW_IMAGES");
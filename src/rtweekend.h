@@ -2,10 +2,25 @@
 #define __RTWEEKEND_H__
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <random>
+#include <type_traits>
+
+// Build with ACE_SINGLE_PRECISION=1 to store scene geometry and bvh bounds in float and traverse
+// in float. Intersection and shading arithmetic stays in double either way.
+#ifndef ACE_SINGLE_PRECISION
+#define ACE_SINGLE_PRECISION 0
+#endif
+
+#if ACE_SINGLE_PRECISION
+using real = float;
+#else
+using real = double;
+#endif
 
 // Usings
 using std::unique_ptr;
@@ -23,8 +38,54 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
-static std::random_device _rd;
-static thread_local std::mt19937 _generator(_rd());
+template<typename T = double>
+constexpr T rounding_error(int n) {
+    // bound on the relative error after n rounded operations in T, gamma(n) in pbrt
+    constexpr auto e = std::numeric_limits<T>::epsilon() / 2;
+    return (n * e) / (1 - n * e);
+}
+
+template<typename T>
+inline T next_up(T x) {
+    // the next representable value above x, std::nextafter without the library call
+    using bits_type = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+    if (std::isinf(x) && x > 0) {
+        return x;
+    }
+    if (x == 0) {
+        x = 0; // -0 steps up the same as +0
+    }
+    bits_type bits;
+    std::memcpy(&bits, &x, sizeof(x));
+    bits = x >= 0 ? bits + 1 : bits - 1;
+    std::memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+template<typename T>
+inline T next_down(T x) {
+    return -next_up(-x);
+}
+
+template<typename T>
+inline T round_down(double x) {
+    // nearest T no greater than x
+    auto r = static_cast<T>(x);
+    return r > x ? next_down(r) : r;
+}
+
+template<typename T>
+inline T round_up(double x) {
+    // nearest T no less than x
+    auto r = static_cast<T>(x);
+    return r < x ? next_up(r) : r;
+}
+
+// One generator per thread, shared by every translation unit, so seed_random reseeds it for
+// all of them. A resumed render seeds each pixel the way the first run did and has to draw the
+// same numbers wherever they are drawn from
+inline std::random_device _rd;
+inline thread_local std::mt19937 _generator(_rd());
 
 inline double random_double() {
     // returns a random real in [0,1)
@@ -42,4 +103,34 @@ inline int random_integer(int min, int max) {
     return distribution(_generator);
 }
 
+inline void seed_random(uint64_t seed) {
+    // reseeds the generator for the calling thread only
+    _generator.seed(static_cast<std::mt19937::result_type>(seed ^ (seed >> 32)));
+}
+
+inline uint64_t hash_combine(uint64_t h, uint64_t v) {
+    // mix v into h using the splitmix64 finalizer
+    uint64_t z = h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Random numbers that are a hash of a key and how many have been drawn, so they don't depend
+// on the thread's generator or on what else was drawn before them
+class random_sequence {
+public:
+    explicit random_sequence(uint64_t key) : key(key) {}
+
+    double next_double() {
+        // returns a random real in [0,1) from the top 53 bits
+        index += 1;
+        return static_cast<double>(hash_combine(key, index) >> 11) * 0x1.0p-53;
+    }
+
+private:
+    uint64_t key;
+    uint64_t index = 0;
+};
+
 #endif//__RTWEEKEND_H__
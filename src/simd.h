@@ -0,0 +1,156 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Four floats processed together, on SSE2 or NEON when available and as a plain loop
+// otherwise. Comparisons return masks with every bit of a lane set or clear. Which instructions
+// are used follows the compiler flags, see ACE_SIMD in CMakeLists.txt, and ACE_SIMD_DISABLE
+// turns them all off. NEON is only used on arm64, 32-bit arm has no vector divide, square root
+// or horizontal add, so it gets the plain loop.
+#if defined(ACE_SIMD_DISABLE) && ACE_SIMD_DISABLE
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ACE_SIMD_SSE 1
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64)
+#define ACE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+struct float4 {
+#if defined(ACE_SIMD_SSE)
+    __m128 v;
+
+    float4() = default;
+    float4(__m128 _v) : v(_v) {}
+
+    static float4 broadcast(float f) { return _mm_set1_ps(f); }
+    static float4 load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+#elif defined(ACE_SIMD_NEON)
+    float32x4_t v;
+
+    float4() = default;
+    float4(float32x4_t _v) : v(_v) {}
+
+    static float4 broadcast(float f) { return vdupq_n_f32(f); }
+    static float4 load(const float* p) { return vld1q_f32(p); }
+    void store(float* p) const { vst1q_f32(p, v); }
+#else
+    float v[4];
+
+    static float4 broadcast(float f) {
+        float4 r;
+        for (int i = 0; i < 4; i += 1) {
+            r.v[i] = f;
+        }
+        return r;
+    }
+
+    static float4 load(const float* p) {
+        float4 r;
+        std::memcpy(r.v, p, sizeof(r.v));
+        return r;
+    }
+
+    void store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+#endif
+};
+
+#if defined(ACE_SIMD_SSE)
+
+inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+inline float4 min(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+inline float4 max(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+inline float4 sqrt(float4 a) { return _mm_sqrt_ps(a.v); }
+inline float4 abs(float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline float4 operator<=(float4 a, float4 b) { return _mm_cmple_ps(a.v, b.v); }
+inline float4 operator>=(float4 a, float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline float4 operator&(float4 a, float4 b) { return _mm_and_ps(a.v, b.v); }
+
+// one bit per lane, lane 0 in the lowest bit
+inline int mask_bits(float4 m) { return _mm_movemask_ps(m.v); }
+
+#elif defined(ACE_SIMD_NEON)
+
+inline float4 operator+(float4 a, float4 b) { return vaddq_f32(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return vsubq_f32(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return vmulq_f32(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) { return vdivq_f32(a.v, b.v); }
+inline float4 min(float4 a, float4 b) { return vminq_f32(a.v, b.v); }
+inline float4 max(float4 a, float4 b) { return vmaxq_f32(a.v, b.v); }
+inline float4 sqrt(float4 a) { return vsqrtq_f32(a.v); }
+inline float4 abs(float4 a) { return vabsq_f32(a.v); }
+inline float4 operator<=(float4 a, float4 b) { return vreinterpretq_f32_u32(vcleq_f32(a.v, b.v)); }
+inline float4 operator>=(float4 a, float4 b) { return vreinterpretq_f32_u32(vcgeq_f32(a.v, b.v)); }
+inline float4 operator&(float4 a, float4 b) { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); }
+
+inline int mask_bits(float4 m) {
+    static const int32_t weights[4] = { 1, 2, 4, 8 };
+    auto bits = vandq_s32(vreinterpretq_s32_f32(m.v), vld1q_s32(weights));
+    return vaddvq_s32(bits);
+}
+
+#else
+
+namespace simd_detail {
+    template<typename F>
+    inline float4 map(float4 a, float4 b, F f) {
+        float4 r;
+        for (int i = 0; i < 4; i += 1) {
+            r.v[i] = f(a.v[i], b.v[i]);
+        }
+        return r;
+    }
+
+    inline float mask_lane(bool set) {
+        uint32_t bits = set ? 0xffffffffu : 0u;
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    inline uint32_t lane_bits(float f) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+}
+
+inline float4 operator+(float4 a, float4 b) { return simd_detail::map(a, b, [](float x, float y) { return x + y; }); }
+inline float4 operator-(float4 a, float4 b) { return simd_detail::map(a, b, [](float x, float y) { return x - y; }); }
+inline float4 operator*(float4 a, float4 b) { return simd_detail::map(a, b, [](float x, float y) { return x * y; }); }
+inline float4 operator/(float4 a, float4 b) { return simd_detail::map(a, b, [](float x, float y) { return x / y; }); }
+inline float4 min(float4 a, float4 b) { return simd_detail::map(a, b, [](float x, float y) { return y < x ? y : x; }); }
+inline float4 max(float4 a, float4 b) { return simd_detail::map(a, b, [](float x, float y) { return y > x ? y : x; }); }
+inline float4 sqrt(float4 a) { return simd_detail::map(a, a, [](float x, float) { return std::sqrt(x); }); }
+inline float4 abs(float4 a) { return simd_detail::map(a, a, [](float x, float) { return std::fabs(x); }); }
+inline float4 operator<=(float4 a, float4 b) { return simd_detail::map(a, b, [](float x, float y) { return simd_detail::mask_lane(x <= y); }); }
+inline float4 operator>=(float4 a, float4 b) { return simd_detail::map(a, b, [](float x, float y) { return simd_detail::mask_lane(x >= y); }); }
+
+inline float4 operator&(float4 a, float4 b) {
+    return simd_detail::map(a, b, [](float x, float y) {
+        auto bits = simd_detail::lane_bits(x) & simd_detail::lane_bits(y);
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    });
+}
+
+inline int mask_bits(float4 m) {
+    int bits = 0;
+    for (int i = 0; i < 4; i += 1) {
+        bits |= (simd_detail::lane_bits(m.v[i]) >> 31) << i;
+    }
+    return bits;
+}
+
+#endif
+
+#endif//__SIMD_H__
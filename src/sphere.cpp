@@ -4,8 +4,9 @@
 #include <spdlog/fmt/bundled/core.h>
 
 sphere::sphere(point3 _center, double _radius, shared_ptr<material> _material)
-    :center1(_center), radius(_radius), mat(_material)
+    :center1(_center), radius(static_cast<real>(_radius)), mat(_material)
 {
+    // bounds of the stored centre and radius, which in single precision differ from the arguments
     auto rvec = vec3(radius, radius, radius);
     bbox = aabb(center1 - rvec, center1 + rvec);
 
@@ -14,22 +15,24 @@ sphere::sphere(point3 _center, double _radius, shared_ptr<material> _material)
 }
 
 sphere::sphere(point3 _center1, point3 _center2, double _radius, shared_ptr<material> _material)
-    : center1(_center1), radius(_radius), mat(_material), is_moving(true)
+    : center1(_center1), radius(static_cast<real>(_radius)), mat(_material), is_moving(true)
 {
+    center_vec = _center2 - _center1;
+
     auto rvec = vec3(radius, radius, radius);
-    aabb box1(_center1 - rvec, _center1 + rvec);
-    aabb box2(_center2 - rvec, _center2 + rvec);
+    aabb box1(center1 - rvec, center1 + rvec);
+    aabb box2(center(1) - rvec, center(1) + rvec);
     bbox = aabb(box1, box2);
-
-    center_vec = _center2 - _center1;
 }
 
 bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
-    point3 center0 = is_moving ? sphere::center(r.time()) : center1;
+    STAT_INC(sphere_tests);
+
+    point3 center0 = is_moving ? sphere::center(r.time()) : point3(center1);
     vec3 oc = r.origin() - center0;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius * radius;
+    auto c = oc.length_squared() - static_cast<double>(radius) * radius;
 
     auto discriminant = half_b * half_b - a * c;
     if (discriminant < 0) {
@@ -47,9 +50,14 @@ bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
         }
     }
 
+    // project the hit back onto the sphere, which bounds its error by the sphere's size alone
+    auto from_center = r.at(root) - center0;
+    from_center *= radius / from_center.length();
+
     rec.t = root;
-    rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - center0) / radius;
+    rec.p = center0 + from_center;
+    rec.p_error = rounding_error(6) * (max_abs_component(center0) + radius);
+    vec3 outward_normal = from_center / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
     rec.mat = mat;
@@ -15,21 +15,27 @@ public:
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
     aabb bounding_box() const override;
+
+    bool clip_box(const aabb& region, aabb& clipped) const override {
+        clipped = overlap(bbox, region);
+        return true;
+    }
+
     void draw(const draw_options& options) const override;
 
+    static void get_sphere_uv(const point3& p, double& u, double& v);
+
 private:
-    point3 center1;
-    double radius;
+    point3r center1;
+    real radius;
     shared_ptr<material> mat;
     bool is_moving;
-    vec3 center_vec;
+    vec3r center_vec;
     aabb bbox;
 
     inline point3 center(double time) const {
         return center1 + time * center_vec;
     }
-
-    static void get_sphere_uv(const point3& p, double& u, double& v);
 };
 
 #endif// __SPHERE_H__
@@ -0,0 +1,284 @@
+#include "sphere_set.h"
+#include "sphere.h"
+#include "material.h"
+#include "simd.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <limits>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/color.h>
+
+void sphere_set::add(const point3& center, double radius, shared_ptr<material> mat) {
+    // a set of particles can have a material each, so ids are looked up rather than searched for
+    auto [entry, added] = material_index.try_emplace(mat.get(), static_cast<uint32_t>(materials.size()));
+    if (added) {
+        materials.push_back(mat);
+    }
+    auto id = entry->second;
+
+    cx.push_back(static_cast<float>(center.x()));
+    cy.push_back(static_cast<float>(center.y()));
+    cz.push_back(static_cast<float>(center.z()));
+    radii.push_back(static_cast<float>(radius));
+    material_ids.push_back(id);
+
+    // bounds of the stored float sphere, not the one passed in
+    point3 stored(cx.back(), cy.back(), cz.back());
+    auto rvec = vec3(radii.back(), radii.back(), radii.back());
+    bbox = aabb(bbox, aabb(stored - rvec, stored + rvec));
+}
+
+void sphere_set::build() {
+    using namespace fmt;
+
+    auto count = static_cast<uint32_t>(size());
+    nodes.clear();
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; i += 1) {
+        order[i] = i;
+    }
+
+    nodes.reserve(2 * (count / leaf_size + 1));
+    build_node(order, 0, count);
+
+    // store the spheres in leaf order, so each leaf reads a contiguous run of every array
+    auto reorder = [&order](auto& values) {
+        auto sorted = values;
+        for (size_t i = 0; i < order.size(); i += 1) {
+            sorted[i] = values[order[i]];
+        }
+        values = std::move(sorted);
+    };
+    reorder(cx);
+    reorder(cy);
+    reorder(cz);
+    reorder(radii);
+    reorder(material_ids);
+
+    // the last leaf loads a whole group of four, so pad past the end. the padding is masked off
+    for (int i = 0; i < 4; i += 1) {
+        cx.push_back(0);
+        cy.push_back(0);
+        cz.push_back(0);
+        radii.push_back(0);
+    }
+
+    cx.shrink_to_fit();
+    cy.shrink_to_fit();
+    cz.shrink_to_fit();
+    radii.shrink_to_fit();
+    material_ids.shrink_to_fit();
+    nodes.shrink_to_fit();
+
+    spdlog::debug("Built sphere set of {} spheres with {} nodes, {} per sphere", count, nodes.size(),
+        format(fg(color::aqua), "{:.1f} bytes", static_cast<double>(bytes_used()) / count));
+}
+
+uint32_t sphere_set::build_node(std::vector<uint32_t>& order, uint32_t start, uint32_t end) {
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(node{});
+
+    const auto inf = std::numeric_limits<float>::infinity();
+    float min[3] = { inf, inf, inf };
+    float max[3] = { -inf, -inf, -inf };
+    float centroid_min[3] = { inf, inf, inf };
+    float centroid_max[3] = { -inf, -inf, -inf };
+
+    for (auto i = start; i < end; i += 1) {
+        auto s = order[i];
+        float c[3] = { cx[s], cy[s], cz[s] };
+        for (int a = 0; a < 3; a += 1) {
+            min[a] = std::min(min[a], c[a] - radii[s]);
+            max[a] = std::max(max[a], c[a] + radii[s]);
+            centroid_min[a] = std::min(centroid_min[a], c[a]);
+            centroid_max[a] = std::max(centroid_max[a], c[a]);
+        }
+    }
+
+    // pad so rounding in the float slab test can't cut off the edge of a sphere
+    for (int a = 0; a < 3; a += 1) {
+        auto pad = 1e-5f * (std::fabs(min[a]) + std::fabs(max[a]) + 1.0f);
+        nodes[index].min[a] = min[a] - pad;
+        nodes[index].max[a] = max[a] + pad;
+    }
+
+    if (end - start <= leaf_size) {
+        nodes[index].index = start;
+        nodes[index].count = end - start;
+        return index;
+    }
+
+    // split at the median centroid along the widest axis
+    int axis = 0;
+    for (int a = 1; a < 3; a += 1) {
+        if (centroid_max[a] - centroid_min[a] > centroid_max[axis] - centroid_min[axis]) {
+            axis = a;
+        }
+    }
+
+    const auto& centres = axis == 0 ? cx : axis == 1 ? cy : cz;
+    auto mid = start + (end - start) / 2;
+    std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&centres](uint32_t a, uint32_t b) {
+        return centres[a] < centres[b];
+    });
+
+    build_node(order, start, mid);
+    auto right = build_node(order, mid, end);
+
+    nodes[index].index = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+size_t sphere_set::bytes_used() const {
+    return (cx.capacity() + cy.capacity() + cz.capacity() + radii.capacity()) * sizeof(float)
+        + material_ids.capacity() * sizeof(uint32_t)
+        + materials.capacity() * sizeof(shared_ptr<material>)
+        + nodes.capacity() * sizeof(node);
+}
+
+bool sphere_set::hit(const ray& r, interval ray_t, hit_record& rec) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    const auto& o = r.origin();
+    const auto& d = r.direction();
+
+    float origin[3] = { static_cast<float>(o.x()), static_cast<float>(o.y()), static_cast<float>(o.z()) };
+    float inv_dir[3] = { static_cast<float>(1.0 / d.x()), static_cast<float>(1.0 / d.y()), static_cast<float>(1.0 / d.z()) };
+
+    // the sphere test works along the unit direction, so distances don't depend on |d|
+    auto length = d.length();
+    auto dn = d / length;
+    auto ox = float4::broadcast(origin[0]);
+    auto oy = float4::broadcast(origin[1]);
+    auto oz = float4::broadcast(origin[2]);
+    auto dx = float4::broadcast(static_cast<float>(dn.x()));
+    auto dy = float4::broadcast(static_cast<float>(dn.y()));
+    auto dz = float4::broadcast(static_cast<float>(dn.z()));
+    auto tmin = float4::broadcast(static_cast<float>(ray_t.min * length));
+
+    bool hit_anything = false;
+    auto closest = ray_t.max;
+
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const auto& n = nodes[stack[--top]];
+        STAT_INC(bvh_nodes_visited);
+
+        // slab test against the node bounds
+        float t0 = static_cast<float>(ray_t.min);
+        float t1 = static_cast<float>(closest);
+        for (int a = 0; a < 3; a += 1) {
+            auto ta = (n.min[a] - origin[a]) * inv_dir[a];
+            auto tb = (n.max[a] - origin[a]) * inv_dir[a];
+            t0 = std::max(t0, std::min(ta, tb));
+            t1 = std::min(t1, std::max(ta, tb));
+        }
+        if (t0 > t1 * 1.00001f) {
+            continue;
+        }
+
+        if (n.count == 0) {
+            auto index = static_cast<uint32_t>(&n - nodes.data());
+            stack[top++] = n.index;
+            stack[top++] = index + 1;
+            continue;
+        }
+
+        // Test four spheres at a time. The float test only filters: the perpendicular distance
+        // of the centre from the ray is compared against a slightly inflated radius, which
+        // avoids the cancellation in the usual quadratic, and anything that passes is
+        // intersected exactly below
+        auto tmax = float4::broadcast(static_cast<float>(closest * length));
+        STAT_ADD(sphere_tests, n.count);
+
+        for (uint32_t first = n.index; first < n.index + n.count; first += 4) {
+            auto ocx = float4::load(&cx[first]) - ox;
+            auto ocy = float4::load(&cy[first]) - oy;
+            auto ocz = float4::load(&cz[first]) - oz;
+            auto radius = float4::load(&radii[first]);
+
+            auto b = ocx * dx + ocy * dy + ocz * dz; // distance along the ray to the closest approach
+            auto px = ocx - b * dx;
+            auto py = ocy - b * dy;
+            auto pz = ocz - b * dz;
+            auto perp2 = px * px + py * py + pz * pz;
+
+            auto slack = float4::broadcast(1e-3f) * radius + float4::broadcast(1e-5f) * (abs(b) + float4::broadcast(1.0f));
+            auto inflated = radius + slack;
+            auto h2 = inflated * inflated - perp2;
+            auto h = sqrt(max(h2, float4::broadcast(0.0f)));
+
+            auto candidates = (h2 >= float4::broadcast(0.0f)) & (b + h >= tmin - slack) & (b - h <= tmax + slack);
+            auto bits = mask_bits(candidates);
+
+            // lanes past the end of the leaf belong to the next leaf or the padding
+            auto lanes = std::min<uint32_t>(4, n.index + n.count - first);
+            bits &= (1 << lanes) - 1;
+
+            for (uint32_t lane = 0; bits != 0; lane += 1, bits >>= 1) {
+                if ((bits & 1) != 0 && hit_sphere(first + lane, r, interval(ray_t.min, closest), rec)) {
+                    hit_anything = true;
+                    closest = rec.t;
+                    tmax = float4::broadcast(static_cast<float>(closest * length));
+                }
+            }
+        }
+    }
+
+    return hit_anything;
+}
+
+bool sphere_set::hit_sphere(uint32_t i, const ray& r, interval ray_t, hit_record& rec) const {
+    // the same test as sphere::hit, on the stored float centre and radius
+    point3 center(cx[i], cy[i], cz[i]);
+    double radius = radii[i];
+
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius * radius;
+
+    auto discriminant = half_b * half_b - a * c;
+    if (discriminant < 0) {
+        return false;
+    }
+
+    auto sqrtd = sqrt(discriminant);
+
+    // Find nearest root that lies in acceptable range
+    auto root = (-half_b - sqrtd) / a;
+    if (!ray_t.surrounds(root)) {
+        root = (-half_b + sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            return false;
+        }
+    }
+
+    auto from_center = r.at(root) - center;
+    from_center *= radius / from_center.length();
+
+    rec.t = root;
+    rec.p = center + from_center;
+    rec.p_error = rounding_error(6) * (max_abs_component(center) + radius);
+    vec3 outward_normal = from_center / radius;
+    rec.set_face_normal(r, outward_normal);
+    sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat = materials[material_ids[i]];
+
+    return true;
+}
+
+aabb sphere_set::bounding_box() const {
+    return bbox;
+}
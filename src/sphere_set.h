@@ -0,0 +1,58 @@
+#ifndef __SPHERE_SET_H__
+#define __SPHERE_SET_H__
+
+#include "hittable.h"
+#include "vec3.h"
+#include "aabb.h"
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Many static spheres stored as one primitive. Centres, radii and material ids are kept in
+// separate float arrays, about 20 bytes per sphere against well over 100 for a sphere object
+// plus its bvh node, and the set has its own bvh whose leaves hold up to leaf_size spheres.
+// A leaf is tested four spheres at a time with SIMD in float, and the few spheres that pass
+// are then intersected exactly in double, so hits match those of sphere.
+//
+// Add every sphere, then call build() before adding the set to a scene.
+class sphere_set : public hittable {
+public:
+    static constexpr int leaf_size = 8;
+
+    void add(const point3& center, double radius, shared_ptr<material> mat);
+    void build();
+
+    size_t size() const {
+        return radii.size();
+    }
+
+    // memory used by the sphere arrays and the bvh, excluding the materials themselves
+    size_t bytes_used() const;
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
+    aabb bounding_box() const override;
+    void draw(const draw_options& options) const override;
+
+private:
+    struct node {
+        float min[3];
+        float max[3];
+        uint32_t index; // first sphere of a leaf, or the right child, the left child is the next node
+        uint32_t count; // spheres in a leaf, 0 for interior nodes
+    };
+
+    std::vector<float> cx, cy, cz;
+    std::vector<float> radii;
+    std::vector<uint32_t> material_ids;
+    std::vector<shared_ptr<material>> materials;
+    std::unordered_map<const material*, uint32_t> material_index; // into materials, for add
+    std::vector<node> nodes;
+    aabb bbox;
+
+    uint32_t build_node(std::vector<uint32_t>& order, uint32_t start, uint32_t end);
+    bool hit_sphere(uint32_t i, const ray& r, interval ray_t, hit_record& rec) const;
+};
+
+#endif//__SPHERE_SET_H__
@@ -0,0 +1,70 @@
+#include "stats.h"
+
+#include <mutex>
+#include <vector>
+#include <spdlog/spdlog.h>
+
+namespace {
+    std::mutex registry_mutex;
+    std::vector<render_stats*> registry;
+    render_stats retired; // counters from threads that have exited since the last reset
+
+    struct registration {
+        render_stats* stats = nullptr;
+
+        ~registration() {
+            if (stats == nullptr) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            retired.merge(*stats);
+            registry.erase(std::remove(registry.begin(), registry.end(), stats), registry.end());
+        }
+    };
+
+    thread_local registration thread_registration;
+}
+
+void stats::register_thread() {
+#if ACE_ENABLE_STATS
+    if (thread_registration.stats != nullptr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    thread_registration.stats = &local;
+    registry.push_back(&local);
+#endif
+}
+
+void stats::reset() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto* s : registry) {
+        *s = render_stats{};
+    }
+    retired = render_stats{};
+}
+
+render_stats stats::collect() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    render_stats total = retired;
+    for (const auto* s : registry) {
+        total.merge(*s);
+    }
+    return total;
+}
+
+void render_stats::log() const {
+#if ACE_ENABLE_STATS
+    spdlog::info("Render statistics:");
+    spdlog::info("  camera rays: {}", camera_rays);
+    spdlog::info("  bounce rays: {}", bounce_rays);
+    spdlog::info("  bvh nodes visited: {}", bvh_nodes_visited);
+    spdlog::info("  aabb tests: {}", aabb_tests);
+    spdlog::info("  primitive tests: {} (sphere {}, quad {}, box {}, medium {})", primitive_tests(), sphere_tests, quad_tests, box_tests, medium_tests);
+    spdlog::info("  instance tests: {}", instance_tests);
+    spdlog::info("  packets: {} ({} nodes culled, {} splits)", packets, packet_culls, packet_splits);
+    spdlog::info("  path depth: {:.2f} average, {} max", average_path_depth(), max_path_depth);
+#endif
+}
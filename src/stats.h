@@ -0,0 +1,82 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <algorithm>
+#include <cstdint>
+
+// Build with ACE_ENABLE_STATS=0 to compile every counter out of the hot paths
+#ifndef ACE_ENABLE_STATS
+#define ACE_ENABLE_STATS 1
+#endif
+
+struct render_stats {
+    uint64_t camera_rays = 0;
+    uint64_t bounce_rays = 0;
+    uint64_t bvh_nodes_visited = 0;
+    uint64_t aabb_tests = 0;
+    uint64_t sphere_tests = 0;
+    uint64_t quad_tests = 0;
+    uint64_t box_tests = 0;
+    uint64_t medium_tests = 0;
+    uint64_t instance_tests = 0;
+    uint64_t packets = 0;
+    uint64_t packet_culls = 0; // bvh nodes culled for a whole packet with one test
+    uint64_t packet_splits = 0; // subtrees finished ray by ray once a packet lost coherence
+    uint64_t paths = 0;
+    uint64_t total_path_depth = 0;
+    uint64_t max_path_depth = 0;
+
+    void merge(const render_stats& other) {
+        camera_rays += other.camera_rays;
+        bounce_rays += other.bounce_rays;
+        bvh_nodes_visited += other.bvh_nodes_visited;
+        aabb_tests += other.aabb_tests;
+        sphere_tests += other.sphere_tests;
+        quad_tests += other.quad_tests;
+        box_tests += other.box_tests;
+        medium_tests += other.medium_tests;
+        instance_tests += other.instance_tests;
+        packets += other.packets;
+        packet_culls += other.packet_culls;
+        packet_splits += other.packet_splits;
+        paths += other.paths;
+        total_path_depth += other.total_path_depth;
+        max_path_depth = std::max(max_path_depth, other.max_path_depth);
+    }
+
+    uint64_t primitive_tests() const {
+        return sphere_tests + quad_tests + box_tests + medium_tests;
+    }
+
+    double average_path_depth() const {
+        return paths > 0 ? static_cast<double>(total_path_depth) / paths : 0.0;
+    }
+
+    void log() const;
+};
+
+namespace stats {
+    // counters for the calling thread, constant initialized so access is a plain tls load
+    inline thread_local render_stats local;
+
+    // make the calling thread's counters visible to collect(), cheap to call repeatedly
+    void register_thread();
+
+    // zero the counters of every registered thread, only call while no render is running
+    void reset();
+
+    // sum the counters of every registered thread, only call once the render has joined
+    render_stats collect();
+}
+
+#if ACE_ENABLE_STATS
+#define STAT_INC(field) (stats::local.field += 1)
+#define STAT_ADD(field, n) (stats::local.field += (n))
+#define STAT_MAX(field, n) (stats::local.field = std::max<uint64_t>(stats::local.field, (n)))
+#else
+#define STAT_INC(field) ((void)0)
+#define STAT_ADD(field, n) ((void)sizeof(n))
+#define STAT_MAX(field, n) ((void)sizeof(n))
+#endif
+
+#endif//__STATS_H__
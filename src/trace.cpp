@@ -0,0 +1,181 @@
+#include "trace.h"
+#include "trace_observer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/bundled/core.h>
+
+namespace {
+    struct trace_event {
+        const char* name;
+        const char* category;
+        trace::clock::time_point start;
+        trace::clock::time_point end;
+        std::string args;
+    };
+
+    struct thread_buffer {
+        int tid = 0;
+        std::string name;
+        std::vector<trace_event> events;
+    };
+
+    std::atomic<bool> tracing_enabled{false};
+    const trace::clock::time_point epoch = trace::clock::now();
+
+    std::mutex registry_mutex;
+    std::vector<thread_buffer*> registry;
+    std::vector<thread_buffer> retired; // buffers of threads that have already exited
+    int next_tid = 1;
+
+    struct registration {
+        thread_buffer* buffer = nullptr;
+
+        ~registration() {
+            if (buffer == nullptr) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            registry.erase(std::remove(registry.begin(), registry.end(), buffer), registry.end());
+            retired.push_back(std::move(*buffer));
+            delete buffer;
+        }
+    };
+
+    thread_local registration thread_registration;
+
+    thread_buffer& local_buffer() {
+        if (thread_registration.buffer == nullptr) {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            thread_registration.buffer = new thread_buffer();
+            thread_registration.buffer->tid = next_tid++;
+            registry.push_back(thread_registration.buffer);
+        }
+        return *thread_registration.buffer;
+    }
+
+    double to_us(trace::clock::time_point t) {
+        return std::chrono::duration<double, std::micro>(t - epoch).count();
+    }
+
+    std::string escape(const std::string& str) {
+        std::string out;
+        for (auto c : str) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out;
+    }
+
+    void write_buffer(std::ofstream& out, const thread_buffer& buffer, bool& first) {
+        auto separator = [&]() {
+            out << (first ? "\n" : ",\n");
+            first = false;
+        };
+
+        if (!buffer.name.empty()) {
+            separator();
+            out << fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}", buffer.tid, escape(buffer.name));
+        }
+
+        for (const auto& e : buffer.events) {
+            separator();
+            out << fmt::format("{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{{}}}}}",
+                escape(e.name), e.category, buffer.tid, to_us(e.start), to_us(e.end) - to_us(e.start), e.args);
+        }
+    }
+}
+
+void trace::enable() {
+    tracing_enabled = true;
+}
+
+bool trace::enabled() {
+    return tracing_enabled.load(std::memory_order_relaxed);
+}
+
+void trace::set_thread_name(const std::string& name) {
+    if (!enabled()) {
+        return;
+    }
+
+    local_buffer().name = name;
+}
+
+void trace::record(const char* name, const char* category, clock::time_point start, clock::time_point end, std::string args) {
+    local_buffer().events.push_back(trace_event{ name, category, start, end, std::move(args) });
+}
+
+bool trace::write(const std::string& filename) {
+    // only safe once the traced work has finished, the per-thread buffers are not locked
+    spdlog::info("Writing trace to {}", filename);
+
+    std::ofstream out(filename);
+    if (!out) {
+        spdlog::error("Failed to open trace file: {}", filename);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const auto& buffer : retired) {
+        write_buffer(out, buffer, first);
+    }
+    for (const auto* buffer : registry) {
+        write_buffer(out, *buffer, first);
+    }
+    out << "\n]}\n";
+
+    return static_cast<bool>(out);
+}
+
+trace_zone& trace_zone::arg(const char* key, long long value) {
+    if (active) {
+        args += fmt::format("{}\"{}\":{}", args.empty() ? "" : ",", key, value);
+    }
+    return *this;
+}
+
+trace_zone& trace_zone::arg(const char* key, const std::string& value) {
+    if (active) {
+        args += fmt::format("{}\"{}\":\"{}\"", args.empty() ? "" : ",", key, escape(value));
+    }
+    return *this;
+}
+
+void trace_observer::set_up(size_t num_workers) {
+    task_starts.assign(num_workers, {});
+}
+
+void trace_observer::on_entry(tf::WorkerView wv, tf::TaskView task_view) {
+    if (!trace::enabled()) {
+        return;
+    }
+
+    auto& starts = task_starts[wv.id()];
+    if (starts.empty()) {
+        trace::set_thread_name(fmt::format("worker {}", wv.id()));
+    }
+    starts.push_back(trace::clock::now());
+}
+
+void trace_observer::on_exit(tf::WorkerView wv, tf::TaskView task_view) {
+    auto& starts = task_starts[wv.id()];
+    if (!trace::enabled() || starts.empty()) {
+        return;
+    }
+
+    auto start = starts.back();
+    starts.pop_back();
+
+    auto name = task_view.name().empty() ? std::string("task") : task_view.name();
+    trace::record("task", "taskflow", start, trace::clock::now(), fmt::format("\"task\":\"{}\",\"worker\":{}", escape(name), wv.id()));
+}
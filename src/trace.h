@@ -0,0 +1,56 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Records timed zones into per-thread buffers and writes them out in the Chrome trace event
+// format, which can be opened in chrome://tracing or https://ui.perfetto.dev
+
+namespace trace {
+    using clock = std::chrono::steady_clock;
+
+    void enable();
+    bool enabled();
+
+    // name the calling thread in the exported timeline
+    void set_thread_name(const std::string& name);
+
+    void record(const char* name, const char* category, clock::time_point start, clock::time_point end, std::string args);
+
+    bool write(const std::string& filename);
+}
+
+class trace_zone {
+public:
+    trace_zone(const char* name, const char* category = "render")
+        : name(name), category(category), active(trace::enabled())
+    {
+        if (active) {
+            start = trace::clock::now();
+        }
+    }
+
+    ~trace_zone() {
+        if (active) {
+            trace::record(name, category, start, trace::clock::now(), std::move(args));
+        }
+    }
+
+    trace_zone(const trace_zone&) = delete;
+    trace_zone& operator=(const trace_zone&) = delete;
+
+    trace_zone& arg(const char* key, long long value);
+    trace_zone& arg(const char* key, const std::string& value);
+
+private:
+    const char* name;
+    const char* category;
+    bool active;
+    trace::clock::time_point start;
+    std::string args;
+};
+
+#endif//__TRACE_H__
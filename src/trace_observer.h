@@ -0,0 +1,22 @@
+#ifndef __TRACE_OBSERVER_H__
+#define __TRACE_OBSERVER_H__
+
+#include "trace.h"
+
+#include <vector>
+#include <taskflow/taskflow.hpp>
+
+// names the executor's worker threads and records a zone for every task they run. kept out of
+// trace.h so only the code that sets up an executor pulls in taskflow
+class trace_observer : public tf::ObserverInterface {
+public:
+    void set_up(size_t num_workers) override;
+    void on_entry(tf::WorkerView wv, tf::TaskView task_view) override;
+    void on_exit(tf::WorkerView wv, tf::TaskView task_view) override;
+
+private:
+    // a worker can run other tasks while joining a subflow, so entries nest
+    std::vector<std::vector<trace::clock::time_point>> task_starts;
+};
+
+#endif//__TRACE_OBSERVER_H__
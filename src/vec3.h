@@ -65,6 +65,27 @@ public:
 
 using point3 = vec3;
 
+// A vec3 as stored in scene geometry, in real rather than double so a single precision build
+// halves the size of every primitive. Converts to vec3 for any arithmetic done on it.
+class vec3r {
+public:
+    real e[3];
+
+    vec3r() : e{0,0,0} {}
+    vec3r(const vec3& v) : e{static_cast<real>(v[0]), static_cast<real>(v[1]), static_cast<real>(v[2])} {}
+
+    inline operator vec3() const { return vec3(e[0], e[1], e[2]); }
+
+    inline real x() const { return e[0]; }
+    inline real y() const { return e[1]; }
+    inline real z() const { return e[2]; }
+
+    inline real operator[](int i) const { return e[i]; }
+    inline real& operator[](int i) { return e[i]; }
+};
+
+using point3r = vec3r;
+
 // Vector Utility Functions
 
 inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
@@ -105,6 +126,10 @@ inline vec3 cross(const vec3 &u, const vec3 &v) {
                 u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
+inline double max_abs_component(const vec3& v) {
+    return fmax(fabs(v.e[0]), fmax(fabs(v.e[1]), fabs(v.e[2])));
+}
+
 inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
@@ -0,0 +1,207 @@
+#include "wavefront.h"
+#include "material.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+    constexpr int cell_bits = 7; // per axis, so 128^3 cells across the scene
+    constexpr int material_kinds = static_cast<int>(material_kind::other) + 1;
+
+    uint32_t spread_bits(uint32_t v) {
+        // moves bit b of v to bit 3b, interleaving three of these gives a morton code
+        uint32_t spread = 0;
+        for (int b = 0; b < cell_bits; b += 1) {
+            spread |= ((v >> b) & 1) << (3 * b);
+        }
+        return spread;
+    }
+}
+
+void path_buffer::resize(size_t count) {
+    for (auto* values : { &lr, &lg, &lb }) {
+        values->resize(count);
+    }
+    resize_slots(count);
+}
+
+void path_buffer::resize_slots(size_t count) {
+    for (auto* values : { &ox, &oy, &oz, &dx, &dy, &dz, &time, &tr, &tg, &tb }) {
+        values->resize(count);
+    }
+    id.resize(count);
+    hits.resize(count);
+    hit.resize(count);
+    alive.resize(count);
+    kind.resize(count);
+    order.resize(count);
+}
+
+void path_buffer::extend(const hittable& world, size_t begin, size_t end) {
+    // scattered rays start just off the surface they leave, so are traced from 0
+    for (auto k = begin; k < end; k += 1) {
+        hit[k] = world.hit(ray_at(k), interval(0, infinity), hits[k]);
+    }
+}
+
+void path_buffer::sort_by_material(size_t begin, size_t end) {
+    // misses first, then a run for each kind of material. a counting sort keeps the slots in
+    // order within a run, so the order doesn't depend on where the materials were allocated
+    size_t offsets[material_kinds + 2] = {};
+    for (auto k = begin; k < end; k += 1) {
+        kind[k] = hit[k] ? static_cast<uint8_t>(hits[k].mat->kind()) + 1 : 0;
+        offsets[kind[k] + 1] += 1;
+    }
+    for (int c = 0; c < material_kinds; c += 1) {
+        offsets[c + 1] += offsets[c];
+    }
+    for (auto k = begin; k < end; k += 1) {
+        order[begin + offsets[kind[k]]++] = static_cast<uint32_t>(k);
+    }
+}
+
+void path_buffer::shade(const colour& background, bool last_bounce, size_t begin, size_t end) {
+    auto k = begin;
+    while (k < end) {
+        auto run = kind[order[k]];
+        auto run_end = k + 1;
+        while (run_end < end && kind[order[run_end]] == run) {
+            run_end += 1;
+        }
+
+        switch (run == 0 ? material_kind::other : static_cast<material_kind>(run - 1)) {
+        case material_kind::lambertian: shade_run<lambertian>(last_bounce, k, run_end); break;
+        case material_kind::metal: shade_run<metal>(last_bounce, k, run_end); break;
+        case material_kind::dielectric: shade_run<dieletric>(last_bounce, k, run_end); break;
+        case material_kind::diffuse_light: shade_run<diffuse_light>(last_bounce, k, run_end); break;
+        case material_kind::isotropic: shade_run<isotropic>(last_bounce, k, run_end); break;
+        case material_kind::other:
+            if (run == 0) {
+                shade_misses(background, k, run_end);
+            } else {
+                shade_run<material>(last_bounce, k, run_end);
+            }
+            break;
+        }
+        k = run_end;
+    }
+}
+
+void path_buffer::shade_misses(const colour& background, size_t begin, size_t end) {
+    for (auto k = begin; k < end; k += 1) {
+        auto i = order[k];
+        gather(i, background);
+        alive[i] = 0;
+    }
+}
+
+template<typename M>
+void path_buffer::shade_run(bool last_bounce, size_t begin, size_t end) {
+    // the concrete classes are final, so for them emitted and scatter aren't virtual calls
+    for (auto k = begin; k < end; k += 1) {
+        auto i = order[k];
+        const auto& rec = hits[i];
+        const auto* mat = static_cast<const M*>(rec.mat.get());
+        gather(i, mat->emitted(rec.u, rec.v, rec.p));
+
+        // the segment after the last bounce would bring no light, so isn't scattered
+        ray scattered;
+        colour attenuation;
+        if (last_bounce || !mat->scatter(ray_at(i), rec, attenuation, scattered)) {
+            alive[i] = 0;
+            continue;
+        }
+
+        STAT_INC(bounce_rays);
+        set_ray(i, scattered);
+        tr[i] *= attenuation.x();
+        tg[i] *= attenuation.y();
+        tb[i] *= attenuation.z();
+    }
+}
+
+size_t path_buffer::compact() {
+    // hits, hit, kind and order are written again before they are next read, so only the path
+    // state moves down
+    size_t kept = 0;
+    for (size_t k = 0; k < live(); k += 1) {
+        if (alive[k] == 0) {
+            continue;
+        }
+        if (kept != k) {
+            for (auto* values : { &ox, &oy, &oz, &dx, &dy, &dz, &time, &tr, &tg, &tb }) {
+                (*values)[kept] = (*values)[k];
+            }
+            id[kept] = id[k];
+            alive[kept] = 1;
+        }
+        kept += 1;
+    }
+
+    resize_slots(kept);
+    return kept;
+}
+
+void path_buffer::reorder(const aabb& bounds) {
+    auto count = live();
+    sort_keys.resize(count);
+    sort_scratch.resize(count);
+    sorted.resize(count);
+    sorted_scratch.resize(count);
+
+    double lo[3];
+    double scale[3];
+    for (int a = 0; a < 3; a += 1) {
+        auto size = static_cast<double>(bounds.axis(a).size());
+        lo[a] = bounds.axis(a).min;
+        scale[a] = std::isfinite(size) && size > 0 ? (1 << cell_bits) / size : 0;
+    }
+
+    // the octant is the top of the key, then the morton code of the cell
+    for (size_t k = 0; k < count; k += 1) {
+        double o[3] = { ox[k], oy[k], oz[k] };
+        uint32_t octant = (dx[k] < 0) | ((dy[k] < 0) << 1) | ((dz[k] < 0) << 2);
+
+        uint32_t code = 0;
+        for (int a = 0; a < 3; a += 1) {
+            auto cell = std::clamp(static_cast<int>((o[a] - lo[a]) * scale[a]), 0, (1 << cell_bits) - 1);
+            code |= spread_bits(static_cast<uint32_t>(cell)) << a;
+        }
+        sort_keys[k] = (octant << (3 * cell_bits)) | code;
+        sorted[k] = static_cast<uint32_t>(k);
+    }
+
+    // a stable radix sort, a byte at a time, keeps the order the same from run to run
+    for (int shift = 0; shift < 3 * cell_bits + 3; shift += 8) {
+        size_t offsets[257] = {};
+        for (size_t k = 0; k < count; k += 1) {
+            offsets[((sort_keys[k] >> shift) & 0xff) + 1] += 1;
+        }
+        for (int b = 0; b < 256; b += 1) {
+            offsets[b + 1] += offsets[b];
+        }
+        for (size_t k = 0; k < count; k += 1) {
+            auto to = offsets[(sort_keys[k] >> shift) & 0xff]++;
+            sort_scratch[to] = sort_keys[k];
+            sorted_scratch[to] = sorted[k];
+        }
+        std::swap(sort_keys, sort_scratch);
+        std::swap(sorted, sorted_scratch);
+    }
+
+    // then every slot array is gathered into that order
+    thread_local std::vector<double> scratch;
+    scratch.resize(count);
+    for (auto* values : { &ox, &oy, &oz, &dx, &dy, &dz, &time, &tr, &tg, &tb }) {
+        for (size_t k = 0; k < count; k += 1) {
+            scratch[k] = (*values)[sorted[k]];
+        }
+        std::copy(scratch.begin(), scratch.end(), values->begin());
+    }
+    for (size_t k = 0; k < count; k += 1) {
+        sort_scratch[k] = id[sorted[k]];
+    }
+    std::swap(id, sort_scratch);
+}
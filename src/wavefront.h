@@ -0,0 +1,103 @@
+#ifndef __WAVEFRONT_H__
+#define __WAVEFRONT_H__
+
+#include "rtweekend.h"
+#include "colour.h"
+#include "hittable.h"
+
+#include <cstdint>
+#include <vector>
+
+// Path state for the wavefront integrator. Rather than following one path to its end before
+// starting the next, as camera::ray_colour does, a wave of paths goes through each stage in
+// turn: every live path is extended by one segment, the hits are sorted by material kind,
+// then shaded, and the finished paths are dropped. A stage is a plain loop over a slice of
+// these arrays so slices run in parallel, and shading the paths of one kind of material in a
+// loop of its own keeps its scatter code hot instead of jumping between every material for
+// every ray.
+//
+// Live paths are packed into slots, one entry in every slot array each, which compact() and
+// reorder() move around. The radiance a path gathers stays put, indexed by the path's id.
+class path_buffer {
+public:
+    std::vector<double> ox, oy, oz;
+    std::vector<double> dx, dy, dz;
+    std::vector<double> time;
+    std::vector<double> tr, tg, tb; // throughput
+    std::vector<uint32_t> id; // path in each slot
+    std::vector<hit_record> hits;
+    std::vector<uint8_t> hit; // the last extend found a hit
+    std::vector<uint8_t> alive;
+    std::vector<uint8_t> kind; // material_kind of the hit plus one, 0 for a miss
+    std::vector<uint32_t> order; // slots, sorted by material kind within every slice
+
+    std::vector<double> lr, lg, lb; // radiance gathered so far, by path id
+
+    // makes room for a wave of count paths, started with path i in slot i
+    void resize(size_t count);
+
+    size_t live() const {
+        return id.size();
+    }
+
+    void start(uint32_t i, const ray& r) {
+        set_ray(i, r);
+        tr[i] = tg[i] = tb[i] = 1;
+        lr[i] = lg[i] = lb[i] = 0;
+        id[i] = i;
+        alive[i] = 1;
+    }
+
+    ray ray_at(size_t slot) const {
+        return ray(point3(ox[slot], oy[slot], oz[slot]), vec3(dx[slot], dy[slot], dz[slot]), time[slot]);
+    }
+
+    colour radiance(uint32_t path) const {
+        return colour(lr[path], lg[path], lb[path]);
+    }
+
+    // The stages, each over the slots [begin, end), taken in the order of order for shade.
+    // sort must see the same slices as the shade after it
+    void extend(const hittable& world, size_t begin, size_t end);
+    void sort_by_material(size_t begin, size_t end);
+    void shade(const colour& background, bool last_bounce, size_t begin, size_t end);
+
+    // drops the paths shade finished, keeping the rest in order, returns how many are left
+    size_t compact();
+
+    // Moves the live paths into order of the cell of bounds each starts in and the octant it
+    // heads into, so paths that will visit the same nodes are extended one after another. The
+    // state moves with the path, so extending still reads every array front to back
+    void reorder(const aabb& bounds);
+
+private:
+    std::vector<uint32_t> sort_keys, sort_scratch, sorted, sorted_scratch;
+
+    void resize_slots(size_t count);
+
+    // shade a run of order holding only misses, or only hits on materials of class M
+    void shade_misses(const colour& background, size_t begin, size_t end);
+    template<typename M>
+    void shade_run(bool last_bounce, size_t begin, size_t end);
+
+    void set_ray(size_t slot, const ray& r) {
+        auto o = r.origin();
+        auto d = r.direction();
+        ox[slot] = o.x();
+        oy[slot] = o.y();
+        oz[slot] = o.z();
+        dx[slot] = d.x();
+        dy[slot] = d.y();
+        dz[slot] = d.z();
+        time[slot] = r.time();
+    }
+
+    void gather(size_t slot, const colour& c) {
+        auto path = id[slot];
+        lr[path] += tr[slot] * c.x();
+        lg[path] += tg[slot] * c.y();
+        lb[path] += tb[slot] * c.z();
+    }
+};
+
+#endif//__WAVEFRONT_H__